@@ -0,0 +1,259 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Roles of the atoms of the standard aminoacids in the bonds (hydrogen donors and acceptors, ionic groups...),
+ * keyed by the name of their residue and their own name.
+ * <br/>
+ * <br/>
+ * Names are interned into integers (up to 4 characters each, as in the PDB format), and the rules below are merged
+ * at compile time into a table with a perfect hash: a lookup is one multiplication and one comparison,
+ * plus one more for the rules that apply to the atoms of any residue (e.g. the main chain).
+ */
+namespace atom_roles
+{
+enum role : uint8_t
+{
+    HYDROGEN_DONOR = 1 << 0,
+    HYDROGEN_ACCEPTOR = 1 << 1,
+    CATION = 1 << 2,
+    POSITIVE_IONIC_GROUP = 1 << 3,
+    NEGATIVE_IONIC_GROUP = 1 << 4,
+    MAIN_CHAIN = 1 << 5
+};
+
+struct entry
+{
+    uint8_t roles = 0;
+
+    // how many hydrogen bonds the atom can donate or accept
+    uint8_t donated = 0;
+    uint8_t accepted = 0;
+
+    [[nodiscard]]
+    constexpr bool has(role r) const
+    { return (roles & r) != 0; }
+};
+
+// the code of names longer than 4 characters (or empty), which no rule refers to
+constexpr uint32_t unknown = UINT32_MAX;
+
+// the residue code of the rules that apply to any residue
+constexpr uint32_t any = 0;
+
+constexpr uint32_t code(std::string_view name)
+{
+    if (name.empty() || name.size() > 4)
+        return unknown;
+
+    uint32_t c = 0;
+    for (char ch : name)
+        c = c << 8 | static_cast<uint8_t>(ch);
+
+    return c;
+}
+
+namespace detail
+{
+struct rule
+{
+    std::string_view residue, atom;
+    entry roles;
+};
+
+// "*" is any residue
+inline constexpr rule rules[] = {
+    // hydrogen donors
+    {"ARG", "NH1", {HYDROGEN_DONOR, 2, 0}},
+    {"ARG", "NH2", {HYDROGEN_DONOR, 2, 0}},
+    {"ARG", "NE", {HYDROGEN_DONOR, 1, 0}},
+    {"ASN", "ND2", {HYDROGEN_DONOR, 2, 0}},
+    {"GLN", "NE2", {HYDROGEN_DONOR, 2, 0}},
+    {"HIS", "NE2", {HYDROGEN_DONOR, 1, 0}},
+    {"HIS", "ND1", {HYDROGEN_DONOR, 1, 0}},
+    {"LYS", "NZ", {HYDROGEN_DONOR, 3, 0}},
+    {"SER", "OG", {HYDROGEN_DONOR, 1, 0}},
+    {"THR", "OG1", {HYDROGEN_DONOR, 1, 0}},
+    {"TRP", "NE1", {HYDROGEN_DONOR, 1, 0}},
+    {"TYR", "OH", {HYDROGEN_DONOR, 1, 0}},
+    {"*", "NH", {HYDROGEN_DONOR, 1, 0}},
+    {"*", "N", {HYDROGEN_DONOR, 1, 0}},
+
+    // hydrogen acceptors
+    {"ASN", "OD1", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"ASP", "OD1", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"ASP", "OD2", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"GLN", "OE1", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"GLU", "OE1", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"GLU", "OE2", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"HIS", "ND1", {HYDROGEN_ACCEPTOR, 0, 1}},
+    {"HIS", "NE2", {HYDROGEN_ACCEPTOR, 0, 1}},
+    {"SER", "OG", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"THR", "OG1", {HYDROGEN_ACCEPTOR, 0, 2}},
+    {"TYR", "OH", {HYDROGEN_ACCEPTOR, 0, 1}},
+    {"*", "O", {HYDROGEN_ACCEPTOR, 0, 1}},
+
+    // cations of cation-pi interactions
+    {"LYS", "NZ", {CATION, 0, 0}},
+    {"ARG", "NH2", {CATION, 0, 0}},
+    {"HIS", "ND1", {CATION, 0, 0}},
+
+    // ionic groups
+    {"HIS", "CG", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"HIS", "CD2", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"HIS", "CE1", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"HIS", "ND1", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"HIS", "NE2", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"ARG", "CZ", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"ARG", "NH2", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"ARG", "NH1", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"ARG", "NE", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"LYS", "NZ", {POSITIVE_IONIC_GROUP, 0, 0}},
+    {"GLU", "CD", {NEGATIVE_IONIC_GROUP, 0, 0}},
+    {"GLU", "OE1", {NEGATIVE_IONIC_GROUP, 0, 0}},
+    {"GLU", "OE2", {NEGATIVE_IONIC_GROUP, 0, 0}},
+    {"ASP", "CG", {NEGATIVE_IONIC_GROUP, 0, 0}},
+    {"ASP", "OD1", {NEGATIVE_IONIC_GROUP, 0, 0}},
+    {"ASP", "OD2", {NEGATIVE_IONIC_GROUP, 0, 0}},
+
+    // main chain
+    {"*", "C", {MAIN_CHAIN, 0, 0}},
+    {"*", "O", {MAIN_CHAIN, 0, 0}},
+    {"*", "H", {MAIN_CHAIN, 0, 0}},
+    {"*", "HA", {MAIN_CHAIN, 0, 0}},
+    {"*", "N", {MAIN_CHAIN, 0, 0}},
+};
+
+constexpr size_t rule_count = sizeof(rules) / sizeof(rules[0]);
+
+constexpr uint64_t key(uint32_t residue, uint32_t atom)
+{ return static_cast<uint64_t>(residue) << 32 | atom; }
+
+constexpr uint64_t key(rule const& r)
+{ return key(r.residue == "*" ? any : code(r.residue), code(r.atom)); }
+
+// no key: its atom code would be unknown
+constexpr uint64_t empty = UINT64_MAX;
+
+struct slot
+{
+    uint64_t key = empty;
+    entry roles;
+};
+
+constexpr entry merge(entry a, entry b)
+{
+    return {
+        static_cast<uint8_t>(a.roles | b.roles),
+        a.donated > b.donated ? a.donated : b.donated,
+        a.accepted > b.accepted ? a.accepted : b.accepted};
+}
+
+// one slot per distinct key, with all of its rules merged; the rules of any residue are merged into the
+// ones of specific residues too, so that a hit on a specific residue needs no other lookup
+constexpr std::array<slot, rule_count> merged_rules()
+{
+    std::array<slot, rule_count> slots{};
+    for (auto const& r : rules)
+    {
+        size_t i = 0;
+        while (slots[i].key != empty && slots[i].key != key(r))
+            ++i;
+
+        slots[i].key = key(r);
+        slots[i].roles = merge(slots[i].roles, r.roles);
+    }
+
+    for (auto& specific : slots)
+    {
+        if (specific.key == empty || specific.key >> 32 == any)
+            continue;
+
+        for (auto const& general : slots)
+            if (general.key == key(any, static_cast<uint32_t>(specific.key)))
+                specific.roles = merge(specific.roles, general.roles);
+    }
+
+    return slots;
+}
+
+inline constexpr auto merged = merged_rules();
+
+// at least twice the slots of the keys, so that a multiplier without collisions is quickly found
+constexpr size_t table_bits = 7;
+constexpr size_t table_size = size_t{1} << table_bits;
+static_assert(2 * rule_count <= table_size, "atom_roles: the table is too small for the rules");
+
+constexpr size_t slot_of(uint64_t key, uint64_t multiplier)
+{ return static_cast<size_t>(key * multiplier >> (64 - table_bits)); }
+
+constexpr bool perfect(uint64_t multiplier)
+{
+    std::array<bool, table_size> taken{};
+    for (auto const& s : merged)
+    {
+        if (s.key == empty)
+            continue;
+
+        auto const i = slot_of(s.key, multiplier);
+        if (taken[i])
+            return false;
+        taken[i] = true;
+    }
+
+    return true;
+}
+
+// the first odd multiplier, from the golden ratio on, that sends each key to a slot of its own
+constexpr uint64_t find_multiplier()
+{
+    uint64_t multiplier = 0x9E3779B97F4A7C15;
+    while (!perfect(multiplier))
+        multiplier += 2;
+
+    return multiplier;
+}
+
+inline constexpr uint64_t multiplier = find_multiplier();
+
+constexpr std::array<slot, table_size> make_table()
+{
+    std::array<slot, table_size> table{};
+    for (auto const& s : merged)
+        if (s.key != empty)
+            table[slot_of(s.key, multiplier)] = s;
+
+    return table;
+}
+
+inline constexpr auto table = make_table();
+
+constexpr slot const* find(uint64_t key)
+{
+    auto const& s = table[slot_of(key, multiplier)];
+    return s.key == key ? &s : nullptr;
+}
+}
+
+// the roles of an atom, given its name and the name of its residue (none if no rule applies to them)
+constexpr entry of(std::string_view residue, std::string_view atom)
+{
+    auto const atom_code = code(atom);
+    if (atom_code == unknown)
+        return {};
+
+    auto const residue_code = code(residue);
+    if (residue_code != unknown && residue_code != any)
+        if (auto const* s = detail::find(detail::key(residue_code, atom_code)); s != nullptr)
+            return s->roles;
+
+    if (auto const* s = detail::find(detail::key(any, atom_code)); s != nullptr)
+        return s->roles;
+
+    return {};
+}
+}
@@ -31,6 +31,7 @@ extern const double surface_dist_vdw;
 extern const double query_dist_ionic;
 extern const double query_dist_pipi;
 extern const double query_dist_pica;
+extern const double query_dist_hydrophobic;
 
 extern const double query_dist_alpha;
 extern const double query_dist_beta;
@@ -42,6 +43,12 @@ extern const double max_limit;
 extern const double max_vdw_radius;
 extern const double max_pipi_atom_atom_distance;
 
+// kdtree subtrees of at least this many elements are built on separate threads
+extern const size_t parallel_build_threshold;
+
+// skin of the neighbor lists kept across models (0: no lists)
+extern const double verlet_skin;
+
 // advanced parameters for deep testing
 extern double const pipistack_normal_normal_angle_range;
 extern double const pipistack_normal_centre_angle_range;
@@ -9,6 +9,17 @@
 /// \return {q, sigma, epsilon (kcal/mol)}
 double* get_vdw_opsl_values(std::string const& residue, std::string const& atom, std::string const& element);
 
+/// Index of the values needed to calculate the vdw energy, or -1 if there are none
+/// \param residue Aminoacid three-letters code
+/// \param atom PDB atom name
+/// \param element Element name
+int get_vdw_opsl_values_index(std::string const& residue, std::string const& atom, std::string const& element);
+
+/// As above, by index
+/// \param index An index returned by get_vdw_opsl_values_index
+/// \return {q, sigma, epsilon (kcal/mol)}
+double* get_vdw_opsl_values(int index);
+
 /// Indicate if there is information to calculate the vdw energy
 /// \param residue Aminoacid three-letters code
 /// \param atom PDB atom name
@@ -7,8 +7,10 @@
 
 #pragma warning(pop)
 
+#include <cstddef>
 #include <string>
 #include <memory>
+#include <memory_resource>
 
 #include "rin_graph.h"
 
@@ -19,6 +21,10 @@
 
 namespace bond
 {
+// the bonds accepted by the tests below (the objects and their reference counts, not the strings they hold)
+// are allocated with this (by default, on the heap)
+using allocator = std::pmr::polymorphic_allocator<std::byte>;
+
 class base
 {
 protected:
@@ -69,10 +75,10 @@ protected:
 
 public:
     [[nodiscard]]
-    chemical_entity::aminoacid get_source() const;
+    chemical_entity::aminoacid const& get_source() const;
 
     [[nodiscard]]
-    chemical_entity::aminoacid get_target() const;
+    chemical_entity::aminoacid const& get_target() const;
 
     [[nodiscard]]
     std::string get_interaction() const override;
@@ -97,7 +103,7 @@ public:
 class hydrophobic final : public generic_bond
 {
 public:
-    static std::shared_ptr<hydrophobic const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b);
+    static std::shared_ptr<hydrophobic const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b, allocator const& alloc = {});
 
     hydrophobic(chemical_entity::atom const& c1, chemical_entity::atom const& c2);
 
@@ -112,7 +118,7 @@ public:
 class contact final : public generic_bond
 {
 public:
-    static std::shared_ptr<contact const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b);
+    static std::shared_ptr<contact const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b, allocator const& alloc = {});
 
     contact(chemical_entity::atom const& a, chemical_entity::atom const& b);
 
@@ -136,7 +142,7 @@ private:
     static double energy(chemical_entity::atom const& donor, chemical_entity::atom const& acceptor, chemical_entity::atom const& hydrogen);
 
 public:
-    static std::shared_ptr<hydrogen const> test(rin::parameters const& params, chemical_entity::atom const& acceptor, chemical_entity::atom const& donor);
+    static std::shared_ptr<hydrogen const> test(rin::parameters const& params, chemical_entity::atom const& acceptor, chemical_entity::atom const& donor, allocator const& alloc = {});
 
     hydrogen(chemical_entity::atom const& acceptor, chemical_entity::atom const& donor, chemical_entity::atom const& hydrogen, double angle);
 
@@ -184,7 +190,7 @@ private:
     chemical_entity::ionic_group const _positive;
 
 public:
-    static std::shared_ptr<ionic const> test(rin::parameters const& params, chemical_entity::ionic_group const& a, chemical_entity::ionic_group const& b);
+    static std::shared_ptr<ionic const> test(rin::parameters const& params, chemical_entity::ionic_group const& a, chemical_entity::ionic_group const& b, allocator const& alloc = {});
 
     ionic(chemical_entity::ionic_group const& negative, chemical_entity::ionic_group const& positive);
 
@@ -222,7 +228,7 @@ private:
     double _angle;
 
 public:
-    static std::shared_ptr<pication const> test(rin::parameters const& params, chemical_entity::atom const& cation, chemical_entity::ring const& ring);
+    static std::shared_ptr<pication const> test(rin::parameters const& params, chemical_entity::atom const& cation, chemical_entity::ring const& ring, allocator const& alloc = {});
 
     pication(chemical_entity::ring const& ring, chemical_entity::atom const& cation, double angle);
 
@@ -268,7 +274,7 @@ private:
     double const _angle;
 
 public:
-    static std::shared_ptr<pipistack const> test(rin::parameters const& params, chemical_entity::ring const& a, chemical_entity::ring const& b);
+    static std::shared_ptr<pipistack const> test(rin::parameters const& params, chemical_entity::ring const& a, chemical_entity::ring const& b, allocator const& alloc = {});
 
     pipistack(chemical_entity::ring const& a, chemical_entity::ring const& b, double angle);
 
@@ -348,7 +354,7 @@ private:
     static double energy(chemical_entity::atom const& source_atom, chemical_entity::atom const& target_atom);
 
 public:
-    static std::shared_ptr<vdw const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b);
+    static std::shared_ptr<vdw const> test(rin::parameters const& params, chemical_entity::atom const& a, chemical_entity::atom const& b, allocator const& alloc = {});
 
     vdw(chemical_entity::atom const& a, chemical_entity::atom const& b);
 
@@ -11,10 +11,12 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <variant>
 #include <set>
 
+#include "atom_roles.h"
 #include "config.h"
 #include "rin_graph.h"
 #include "rin_params.h"
@@ -25,37 +27,55 @@ namespace chemical_entity
 {
 class atom;
 
+class atom_table;
+
 class ring;
 
 class ionic_group;
 
+class aminoacid;
+
+// the aminoacids of a model, which their components refer to by position
+using residue_table = std::vector<aminoacid>;
+
 class aminoacid
 {
 private:
     struct impl;
     std::shared_ptr<impl> _pimpl;
 
-    aminoacid();
-
 public:
     class component
     {
     private:
-        std::weak_ptr<aminoacid::impl> _res_pimpl;
+        // the residue is (*_residues)[_res_index]: the table is not owned, and it must outlive its components
+        residue_table const* _residues;
+        uint32_t _res_index;
 
     protected:
-        explicit component(aminoacid const& res) : _res_pimpl{res._pimpl}
-        {}
+        explicit component(aminoacid const& res);
+
+        // the resource of the atom table of res, which components allocate their own state from
+        [[nodiscard]]
+        static std::pmr::memory_resource* resource_of(aminoacid const& res);
 
     public:
         [[nodiscard]]
-        aminoacid get_residue() const;
+        aminoacid const& get_residue() const;
+
+        [[nodiscard]]
+        uint32_t get_residue_index() const
+        { return _res_index; }
     };
 
     friend class aminoacid::component;
 
 public:
+    // table is the one the aminoacid is going to be appended to, right after its construction;
+    // its atoms are appended to atoms
     aminoacid(
+        residue_table const& table,
+        atom_table& atoms,
         gemmi::Residue const& residue,
         gemmi::Chain const& chain,
         gemmi::Model const& model,
@@ -63,6 +83,8 @@ public:
         rin::parameters const& params);
 
     aminoacid(
+        residue_table const& table,
+        atom_table& atoms,
         gemmi::Residue const& residue,
         gemmi::Chain const& chain,
         gemmi::Model const& model,
@@ -108,6 +130,10 @@ public:
     [[nodiscard]]
     int get_sequence_number() const;
 
+    // position in its residue table
+    [[nodiscard]]
+    uint32_t get_index() const;
+
     bool operator==(aminoacid const& rhs) const;
 
     bool operator!=(aminoacid const& rhs) const;
@@ -125,14 +151,56 @@ public:
     std::array<double, 3> const& get_position() const;
 };
 
+/**
+ * The atoms of a model, stored column by column (structure of arrays), with the properties that the bond tests
+ * and energies need computed once.
+ * <br/>
+ * Rows are only appended, by the constructor of atom, which is a view over one of them:
+ * atoms are valid as long as their table.
+ */
+class atom_table
+{
+private:
+    friend class atom;
+
+    std::pmr::vector<std::string> _name;
+    std::pmr::vector<gemmi::El> _element;
+    std::pmr::vector<atom_roles::entry> _roles;
+    std::pmr::vector<int8_t> _charge;
+    std::pmr::vector<int16_t> _vdw_opsl_index;
+    std::pmr::vector<double> _vdw_radius, _mass;
+    std::pmr::vector<float> _temp_factor;
+    std::pmr::vector<int> _serial;
+
+    // the row of a new atom of res
+    uint32_t append(gemmi::Atom const& record, aminoacid const& res);
+
+public:
+    // the columns (and the entities built over them, see aminoacid) are allocated from resource
+    explicit atom_table(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    [[nodiscard]]
+    std::pmr::memory_resource* resource() const
+    { return _name.get_allocator().resource(); }
+
+    [[nodiscard]]
+    size_t size() const
+    { return _name.size(); }
+
+    // drops the rows from size on (e.g. the atoms of an aminoacid that could not be built)
+    void truncate(size_t size);
+};
+
+// a row of an atom_table; its position is copied, so that it can be moved (see translated)
 class atom final : public kdpoint<3>, public aminoacid::component
 {
 private:
-    struct impl;
-    std::shared_ptr<impl const> _pimpl;
+    atom_table const* _table;
+    uint32_t _row;
 
 public:
-    atom(gemmi::Atom const& record, aminoacid const& res);
+    // it appends the atom to table
+    atom(atom_table& table, gemmi::Atom const& record, aminoacid const& res);
 
     ~atom();
 
@@ -140,7 +208,10 @@ public:
     std::string const& get_name() const;
 
     [[nodiscard]]
-    std::string get_symbol() const;
+    char const* get_symbol() const;
+
+    [[nodiscard]]
+    gemmi::El get_element() const;
 
     [[nodiscard]]
     double get_temp_factor() const;
@@ -172,6 +243,10 @@ public:
     [[nodiscard]]
     bool is_vdw_candidate() const;
 
+    // index of its vdw energy values (see get_vdw_opsl_values), or -1 if it is not a vdw candidate
+    [[nodiscard]]
+    int get_vdw_opsl_index() const;
+
     [[nodiscard]]
     double get_vdw_radius() const;
 
@@ -189,14 +264,26 @@ public:
 
     [[nodiscard]]
     int get_atom_number() const;
+
+    // the same atom, moved by shift (e.g. one of its periodic images)
+    [[nodiscard]]
+    atom translated(std::array<double, 3> const& shift) const;
 };
 
 class ring final : public kdpoint<3>, public aminoacid::component
 {
+public:
+    // rings of the standard residues have 5 or 6 atoms (more, with alternate locations: see _atom_block)
+    static constexpr size_t max_atoms = 6;
+
 private:
     struct impl;
     std::shared_ptr<impl const> _pimpl;
 
+    // coordinates of the atoms, kept here rather than in impl: pi-stacking tests read them for every pair of rings;
+    // empty if they are more than max_atoms, and then distances are computed from the atoms of impl
+    geom::point_block<max_atoms> _atom_block;
+
 public:
     ring(std::vector<atom> const& atoms, aminoacid const& res);
 
@@ -219,6 +306,10 @@ public:
 
     [[nodiscard]]
     std::string get_name() const;
+
+    // the same ring, moved by shift
+    [[nodiscard]]
+    ring translated(std::array<double, 3> const& shift) const;
 };
 
 class ionic_group final : public kdpoint<3>, public aminoacid::component
@@ -240,5 +331,9 @@ public:
 
     [[nodiscard]]
     std::string get_name() const;
+
+    // the same group, moved by shift
+    [[nodiscard]]
+    ionic_group translated(std::array<double, 3> const& shift) const;
 };
 }
\ No newline at end of file
@@ -15,17 +15,54 @@ namespace rin
 {
 struct parameters;
 
+/**
+ * Verlet neighbor lists: the candidate pairs of each family of bonds, kept from one model (frame) to the next.
+ * <br/>
+ * Candidates are searched at the query distance plus a skin, and only rechecked on the following frames,
+ * until some entity has moved more than half of the skin since they were found.
+ * Consecutive frames must share the topology (the same residues and atoms, in the same order).
+ */
+struct neighbor_lists final
+{
+private:
+    struct impl;
+    std::shared_ptr<impl> pimpl;
+
+    friend struct maker;
+
+public:
+    explicit neighbor_lists(double skin);
+
+    ~neighbor_lists();
+
+    // spatial indices built or refitted so far, for the searches of the stale lists:
+    // the ones of fresh lists are neither built nor refitted
+    [[nodiscard]]
+    size_t index_updates() const;
+};
+
 struct maker final
 {
 private:
     struct impl;
     std::shared_ptr<impl const> pimpl;
 
+    rin::graph run(parameters const& params, neighbor_lists* lists) const;
+
 public:
     maker(gemmi::Model const& model, gemmi::Structure const& protein, rin::parameters const& params);
 
+    // as above, but the spatial indices store their coordinates in single precision if requested,
+    // whatever the precision in params
+    maker(
+        gemmi::Model const& model, gemmi::Structure const& protein, rin::parameters const& params,
+        bool single_precision);
+
     ~maker();
 
     rin::graph operator()(parameters const& params) const;
+
+    // as above, but reusing (and updating) the candidate pairs found in the previous frames
+    rin::graph operator()(parameters const& params, neighbor_lists& lists) const;
 };
-}
\ No newline at end of file
+}
@@ -8,6 +8,8 @@
 
 #include "config.h"
 
+#include "spatial/geometry.h"
+
 namespace rin
 {
 struct parameters final
@@ -40,6 +42,18 @@ public:
         FAIL, SKIP_RES, KEEP_RES, KEEP_ALL
     };
 
+    // AUTO chooses one of the others for each family of bonds (see search_cost)
+    enum class spatial_index_t
+    {
+        KDTREE, CELL_GRID, BRUTE_FORCE, AUTO
+    };
+
+    // VALIDATE runs both and reports the edges they disagree on
+    enum class precision_t
+    {
+        DOUBLE, SINGLE, VALIDATE
+    };
+
 private:
     double _query_dist_hbond = cfg::params::query_dist_hbond;
     double _surface_dist_vdw = cfg::params::surface_dist_vdw;
@@ -54,6 +68,12 @@ private:
         _pipistack_normal_normal_angle_range{cfg::params::pipistack_normal_normal_angle_range},
         _pication_angle{cfg::params::pication_angle};
 
+    // the same angles, as limits for the tests of geom (cation-pi bonds need theta >= angle, i.e. 90 - theta <= 90 - angle)
+    geom::angle_limit _hbond_angle_limit{_hbond_angle},
+        _pipistack_normal_centre_limit{_pipistack_normal_centre_angle_range},
+        _pipistack_normal_normal_limit{_pipistack_normal_normal_angle_range},
+        _pication_limit{90 - _pication_angle};
+
     int _sequence_separation = cfg::params::seq_sep;
 
     interaction_type_t _interaction_type = interaction_type_t::NONCOVALENT_BONDS;
@@ -66,10 +86,16 @@ private:
     std::filesystem::path _input{};
     std::variant<output_file, output_directory> _output{};
 
-    bool _skip_water{false}, _no_hydrogen{false}, _csv_out{false};
+    bool _skip_water{false}, _no_hydrogen{false}, _csv_out{false}, _periodic{false};
 
     illformed_policy_t _illformed{};
 
+    spatial_index_t _spatial_index = spatial_index_t::AUTO;
+
+    double _verlet_skin = cfg::params::verlet_skin;
+
+    precision_t _precision = precision_t::DOUBLE;
+
     parameters() = default;
 
     [[nodiscard]]
@@ -133,6 +159,23 @@ public:
     auto pication_angle() const
     { return _pication_angle; }
 
+    [[nodiscard]]
+    auto const& hbond_angle_limit() const
+    { return _hbond_angle_limit; }
+
+    [[nodiscard]]
+    auto const& pipistack_normal_centre_limit() const
+    { return _pipistack_normal_centre_limit; }
+
+    [[nodiscard]]
+    auto const& pipistack_normal_normal_limit() const
+    { return _pipistack_normal_normal_limit; }
+
+    // limit on 90° minus the angle between the normal of the ring and the cation
+    [[nodiscard]]
+    auto const& pication_limit() const
+    { return _pication_limit; }
+
     [[nodiscard]]
     interaction_type_t interaction_type() const
     { return _interaction_type; }
@@ -172,6 +215,22 @@ public:
     [[nodiscard]]
     auto csv_out() const
     { return _csv_out; }
+
+    [[nodiscard]]
+    auto spatial_index() const
+    { return _spatial_index; }
+
+    [[nodiscard]]
+    auto periodic() const
+    { return _periodic; }
+
+    [[nodiscard]]
+    auto verlet_skin() const
+    { return _verlet_skin; }
+
+    [[nodiscard]]
+    auto precision() const
+    { return _precision; }
 };
 
 struct parameters::configurator final
@@ -253,24 +312,28 @@ public:
     configurator& set_hbond_angle(double val)
     {
         params._hbond_angle = val;
+        params._hbond_angle_limit = geom::angle_limit(val);
         return *this;
     }
 
     configurator& set_pipistack_normal_centre_angle_range(double val)
     {
         params._pipistack_normal_centre_angle_range = val;
+        params._pipistack_normal_centre_limit = geom::angle_limit(val);
         return *this;
     }
 
     configurator& set_pipistack_normal_normal_angle_range(double val)
     {
         params._pipistack_normal_normal_angle_range = val;
+        params._pipistack_normal_normal_limit = geom::angle_limit(val);
         return *this;
     }
 
     configurator& set_pication_angle(double val)
     {
         params._pication_angle = val;
+        params._pication_limit = geom::angle_limit(90 - val);
         return *this;
     }
 
@@ -314,5 +377,29 @@ public:
         params._csv_out = should_use;
         return *this;
     }
+
+    configurator& set_spatial_index(spatial_index_t spatial_index)
+    {
+        params._spatial_index = spatial_index;
+        return *this;
+    }
+
+    configurator& set_periodic(bool periodic)
+    {
+        params._periodic = periodic;
+        return *this;
+    }
+
+    configurator& set_verlet_skin(double skin)
+    {
+        params._verlet_skin = skin;
+        return *this;
+    }
+
+    configurator& set_precision(precision_t precision)
+    {
+        params._precision = precision;
+        return *this;
+    }
 };
 }
\ No newline at end of file
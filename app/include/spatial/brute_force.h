@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "kdpoint.h"
+
+/**
+ * Flat array of elements searched by blocked all-pairs scans, with the same range-query interface of cell_grid<T>.
+ * <br/>
+ * <br/>
+ * There is nothing to build but the structure of arrays of the coordinates, and nothing to prune:
+ * it is meant for searches over a few hundred elements at most, where indexing costs more than it saves.
+ * Joins scan the other side in tiles small enough to stay in the L1 cache while every element of this side
+ * is tested against them.
+ * As in kdtree, elements are either points themselves or ids into a shared array of positions,
+ * and coordinates are stored as Real (double or float).
+ */
+template<class T, typename Real = double>
+class brute_force
+{
+    static_assert(std::is_floating_point_v<Real>, "coordinates must be stored as floating point numbers");
+
+    // joins need to look into arrays of other element types
+    template<class, typename>
+    friend class brute_force;
+
+private:
+    std::vector<T> elements;
+
+    // coordinates[axis * size() + i] is the axis-th coordinate of elements[i]
+    std::vector<Real> coordinates;
+
+    // elements of the other side scanned at once by joins: 3 * 512 doubles fit in 12 KiB
+    static constexpr size_t tile_size = 512;
+
+    template<typename Element>
+    void init(std::vector<std::array<double, 3>> const& positions, Element&& element);
+
+    [[nodiscard]]
+    std::array<double, 3> position(size_t i) const
+    { return {coordinates[i], coordinates[elements.size() + i], coordinates[2 * elements.size() + i]}; }
+
+    // the same as kdpoint::distance, computed from the stored coordinates
+    [[nodiscard]]
+    double distance(size_t i, std::array<double, 3> const& p) const
+    { return geom::distance<3>(position(i), p); }
+
+    // the coordinates of the elements in [first, last)
+    [[nodiscard]]
+    std::array<Real const*, 3> block(size_t first) const
+    {
+        std::array<Real const*, 3> b;
+        for (size_t axis = 0; axis < 3; ++axis)
+            b[axis] = coordinates.data() + axis * elements.size() + first;
+
+        return b;
+    }
+
+    // calls visitor(i) for each element i within range from p
+    template<typename Visitor>
+    void visit_range(std::array<double, 3> const& p, double range, Visitor&& visitor) const;
+
+    // join of these elements, translated by -offset, with the other ones
+    template<class U, typename Visitor>
+    void join(brute_force<U, Real> const& other, double range, std::array<double, 3> const& offset, Visitor&& visitor) const;
+
+public:
+    // shallow copy: O(1)
+    brute_force& operator=(brute_force&&) noexcept = default;
+
+    // shallow copy: O(1)
+    brute_force(brute_force&&) noexcept = default;
+
+    // copy of the coordinates: O(n)
+    explicit brute_force(std::vector<T> const&);
+
+    // as above, but over a subset of a shared array of positions: the element ids[i] is at positions[ids[i]],
+    // and T must be an unsigned integer type
+    brute_force(std::vector<std::array<double, 3>> const& positions, std::vector<T> const& ids);
+
+    brute_force() = default;
+
+    ~brute_force() = default;
+
+    // range search: O(n)
+    std::vector<T> range_search(kdpoint<3> const& test, double range) const;
+
+    // as above, but it stores the positions of the neighbors (see operator[]) in a caller-owned buffer
+    void range_search(kdpoint<3> const& test, double range, std::vector<size_t>& neighbors) const;
+
+    // as above, but it calls visitor(T const&) on each neighbor without copying it
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<3> const& test, double range, Visitor&& visitor) const;
+
+    // self-join: it calls visitor(T const& a, T const& b) exactly once for each unordered pair of distinct elements
+    // within range from each other (a is the one that comes first in storage order); O(n^2)
+    template<typename Visitor>
+    void for_each_pair_within(double range, Visitor&& visitor) const;
+
+    // join: it calls visitor(T const& a, U const& b) for each pair of elements, a from this array and b from
+    // the other one, within range from each other; O(n * m)
+    template<class U, typename Visitor>
+    void for_each_pair_within(brute_force<U, Real> const& other, double range, Visitor&& visitor) const;
+
+    // minimum-image searches in a periodic box, with the same semantics of the ones of kdtree
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<3> const& test, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    template<typename Visitor>
+    void for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    template<class U, typename Visitor>
+    void for_each_pair_within(
+        brute_force<U, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    [[nodiscard]]
+    T const& operator[](size_t i) const
+    { return elements[i]; }
+
+    [[nodiscard]]
+    size_t size() const
+    { return elements.size(); }
+};
+
+template<class T, typename Real>
+brute_force<T, Real>::brute_force(std::vector<T> const& vec)
+{
+    std::vector<std::array<double, 3>> positions;
+    positions.reserve(vec.size());
+    for (auto const& e : vec)
+        positions.push_back(static_cast<std::array<double, 3> const&>(e));
+
+    init(positions, [&vec](size_t i) -> T const&
+    { return vec[i]; });
+}
+
+template<class T, typename Real>
+brute_force<T, Real>::brute_force(std::vector<std::array<double, 3>> const& positions, std::vector<T> const& ids)
+{
+    static_assert(std::is_unsigned_v<T>, "ids into a shared array of positions must be unsigned integers");
+
+    std::vector<std::array<double, 3>> subset;
+    subset.reserve(ids.size());
+    for (auto id : ids)
+        subset.push_back(positions[id]);
+
+    init(subset, [&ids](size_t i)
+    { return ids[i]; });
+}
+
+template<class T, typename Real>
+template<typename Element>
+void brute_force<T, Real>::init(std::vector<std::array<double, 3>> const& positions, Element&& element)
+{
+    elements.reserve(positions.size());
+    coordinates.resize(3 * positions.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        elements.push_back(element(i));
+        for (size_t axis = 0; axis < 3; ++axis)
+            coordinates[axis * positions.size() + i] = static_cast<Real>(positions[i][axis]);
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void brute_force<T, Real>::visit_range(std::array<double, 3> const& p, double range, Visitor&& visitor) const
+{
+    geom::for_each_within_radius<3>(
+        p, block(0), elements.size(), range,
+        [this, &p, range](size_t i)
+        { return distance(i, p) <= range; },
+        visitor);
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void brute_force<T, Real>::for_each_in_range(kdpoint<3> const& test, double range, Visitor&& visitor) const
+{
+    visit_range(static_cast<std::array<double, 3> const&>(test), range, [this, &visitor](size_t i)
+    { visitor(elements[i]); });
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void brute_force<T, Real>::for_each_pair_within(double range, Visitor&& visitor) const
+{
+    // the tile [first, last) is tested against every element that comes before its end
+    for (size_t first = 0; first < elements.size(); first += tile_size)
+    {
+        size_t const last = std::min(first + tile_size, elements.size());
+        for (size_t i = 0; i + 1 < last; ++i)
+        {
+            size_t const from = std::max(first, i + 1);
+            auto const p = position(i);
+            geom::for_each_within_radius<3>(
+                p, block(from), last - from, range,
+                [this, from, &p, range](size_t j)
+                { return distance(from + j, p) <= range; },
+                [this, i, from, &visitor](size_t j)
+                { visitor(elements[i], elements[from + j]); });
+        }
+    }
+}
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void brute_force<T, Real>::for_each_pair_within(brute_force<U, Real> const& other, double range, Visitor&& visitor) const
+{ join(other, range, {}, std::forward<Visitor>(visitor)); }
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void brute_force<T, Real>::join(
+    brute_force<U, Real> const& other, double range, std::array<double, 3> const& offset, Visitor&& visitor) const
+{
+    for (size_t first = 0; first < other.elements.size(); first += tile_size)
+    {
+        size_t const last = std::min(first + tile_size, other.elements.size());
+        auto const tile = other.block(first);
+        for (size_t i = 0; i < elements.size(); ++i)
+        {
+            T const& e = elements[i];
+            auto const p = geom::difference<3>(position(i), offset);
+            geom::for_each_within_radius<3>(
+                p, tile, last - first, range,
+                [&other, first, &p, range](size_t j)
+                { return other.distance(first + j, p) <= range; },
+                [&other, first, &e, &visitor](size_t j)
+                { visitor(e, other.elements[first + j]); });
+        }
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void brute_force<T, Real>::for_each_in_range(
+    kdpoint<3> const& test, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("brute_force: range is too large for the minimum image convention in this box");
+
+    auto const& p = static_cast<std::array<double, 3> const&>(test);
+    std::array<double, 3> const none{};
+
+    visit_range(p, range, [this, &visitor, &none](size_t i)
+    { visitor(elements[i], none); });
+
+    // e + shift is within range from p if and only if e is within range from p - shift
+    for (auto const& shift : box.neighbor_shifts())
+    {
+        visit_range(geom::difference<3>(p, shift), range, [this, &visitor, &shift](size_t i)
+        { visitor(elements[i], shift); });
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void brute_force<T, Real>::for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("brute_force: range is too large for the minimum image convention in this box");
+
+    std::array<double, 3> const none{};
+    for_each_pair_within(range, [&visitor, &none](T const& a, T const& b)
+    { visitor(a, b, none); });
+
+    // a pair across the boundary is seen with either shift or -shift: only one of them is tried
+    for (auto const& shift : box.neighbor_shifts(true))
+    {
+        join(*this, range, shift, [&visitor, &shift](T const& a, T const& b)
+        { visitor(a, b, shift); });
+    }
+}
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void brute_force<T, Real>::for_each_pair_within(
+    brute_force<U, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("brute_force: range is too large for the minimum image convention in this box");
+
+    join(other, range, {}, [&visitor](T const& a, U const& b)
+    { visitor(a, b, std::array<double, 3>{}); });
+
+    for (auto const& shift : box.neighbor_shifts())
+    {
+        join(other, range, shift, [&visitor, &shift](T const& a, U const& b)
+        { visitor(a, b, shift); });
+    }
+}
+
+template<class T, typename Real>
+void brute_force<T, Real>::range_search(kdpoint<3> const& test, double range, std::vector<size_t>& neighbors) const
+{
+    neighbors.clear();
+    visit_range(static_cast<std::array<double, 3> const&>(test), range, [&neighbors](size_t i)
+    { neighbors.push_back(i); });
+}
+
+template<class T, typename Real>
+std::vector<T> brute_force<T, Real>::range_search(kdpoint<3> const& test, double range) const
+{
+    std::vector<T> neighbors;
+    for_each_in_range(test, range, [&neighbors](T const& element)
+    { neighbors.push_back(element); });
+
+    return neighbors;
+}
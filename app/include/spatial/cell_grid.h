@@ -0,0 +1,534 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "kdpoint.h"
+#include "range_batch.h"
+
+/**
+ * Uniform-grid cell list, with the same range-query interface of kdtree<T, 3>.
+ * <br/>
+ * <br/>
+ * Space is divided into cubic cells of a fixed edge, which should be about the query distance:
+ * a query then only looks at the 3x3x3 block of cells around the test point.
+ * <br/>
+ * Elements are stored cell by cell in one contiguous array (x-fastest order), and their coordinates in a parallel
+ * structure of arrays, so that each row of cells along x is a single contiguous block.
+ * As in kdtree, elements are either points themselves or ids into a shared array of positions,
+ * and coordinates are stored as Real (double or float).
+ */
+template<class T, typename Real = double>
+class cell_grid
+{
+    static_assert(std::is_floating_point_v<Real>, "coordinates must be stored as floating point numbers");
+
+    // joins need to look into grids of other element types
+    template<class, typename>
+    friend class cell_grid;
+
+private:
+    std::vector<T> elements;
+
+    // coordinates[axis * size() + i] is the axis-th coordinate of elements[i]
+    std::vector<Real> coordinates;
+
+    // the elements of cell c are in [cell_first[c], cell_first[c + 1])
+    std::vector<size_t> cell_first;
+
+    std::array<double, 3> origin{};
+    std::array<size_t, 3> dims{};
+    double cell_size = 1;
+
+    [[nodiscard]]
+    size_t cell_of(std::array<double, 3> const& p) const;
+
+    // bounds of the block of cells intersecting the box [lo, hi]; false if there is none
+    bool cells_overlapping(
+        std::array<double, 3> const& lo, std::array<double, 3> const& hi,
+        std::array<size_t, 3>& low, std::array<size_t, 3>& high) const;
+
+    // lays out the elements: element(i) is the i-th one, at positions[i]
+    template<typename Element>
+    void init(std::vector<std::array<double, 3>> const& positions, Element&& element);
+
+    [[nodiscard]]
+    std::array<double, 3> position(size_t i) const
+    { return {coordinates[i], coordinates[elements.size() + i], coordinates[2 * elements.size() + i]}; }
+
+    // the same as kdpoint::distance, computed from the stored coordinates
+    [[nodiscard]]
+    double distance(size_t i, std::array<double, 3> const& p) const
+    { return geom::distance<3>(position(i), p); }
+
+    // calls visitor(i) for each element i >= from within range from p
+    template<typename Visitor>
+    void visit_range(std::array<double, 3> const& p, double range, Visitor&& visitor, size_t from = 0) const;
+
+    // join of this grid, translated by -offset, with the other one
+    template<class U, typename Visitor>
+    void join(cell_grid<U, Real> const& other, double range, std::array<double, 3> const& offset, Visitor&& visitor) const;
+
+public:
+    // shallow copy: O(1)
+    cell_grid& operator=(cell_grid&&) noexcept = default;
+
+    // shallow copy: O(1)
+    cell_grid(cell_grid&&) noexcept = default;
+
+    // counting sort: O(n)
+    cell_grid(std::vector<T> const&, double cell_size);
+
+    // as above, but over a subset of a shared array of positions: the element ids[i] is at positions[ids[i]],
+    // and T must be an unsigned integer type
+    cell_grid(std::vector<std::array<double, 3>> const& positions, std::vector<T> const& ids, double cell_size);
+
+    cell_grid() = default;
+
+    ~cell_grid() = default;
+
+    // range search: O(1) per cell visited, i.e. O((1 + range/cell_size)^3) for points of bounded density
+    std::vector<T> range_search(kdpoint<3> const& test, double range) const;
+
+    // as above, but it stores the positions of the neighbors (see operator[]) in a caller-owned buffer
+    void range_search(kdpoint<3> const& test, double range, std::vector<size_t>& neighbors) const;
+
+    // as above, but it calls visitor(T const&) on each neighbor without copying it
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<3> const& test, double range, Visitor&& visitor) const;
+
+    // self-join: it calls visitor(T const& a, T const& b) exactly once for each unordered pair of distinct elements
+    // within range from each other (a is the one that comes first in storage order)
+    template<typename Visitor>
+    void for_each_pair_within(double range, Visitor&& visitor) const;
+
+    // join: it calls visitor(T const& a, U const& b) for each pair of elements, a from this grid and b from
+    // the other one, within range from each other; the cells of the other grid to be scanned are found once per cell
+    // of this grid, rather than once per element
+    template<class U, typename Visitor>
+    void for_each_pair_within(cell_grid<U, Real> const& other, double range, Visitor&& visitor) const;
+
+    // minimum-image searches in a periodic box, with the same semantics of the ones of kdtree
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<3> const& test, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    template<typename Visitor>
+    void for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    template<class U, typename Visitor>
+    void for_each_pair_within(
+        cell_grid<U, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    // batch of range searches: queries are sorted in Z-order and run in tiles that share one lookup of the cells;
+    // the neighbors (see operator[]) are grouped per query, in the same order of queries
+    template<class Q>
+    range_batch batch_range_search(std::vector<Q> const& queries, double range) const;
+
+    [[nodiscard]]
+    T const& operator[](size_t i) const
+    { return elements[i]; }
+
+    [[nodiscard]]
+    size_t size() const
+    { return elements.size(); }
+
+    [[nodiscard]]
+    double get_cell_size() const
+    { return cell_size; }
+};
+
+template<class T, typename Real>
+size_t cell_grid<T, Real>::cell_of(std::array<double, 3> const& p) const
+{
+    std::array<size_t, 3> c{};
+    for (size_t axis = 0; axis < 3; ++axis)
+        c[axis] = std::min(static_cast<size_t>((p[axis] - origin[axis]) / cell_size), dims[axis] - 1);
+
+    return (c[2] * dims[1] + c[1]) * dims[0] + c[0];
+}
+
+template<class T, typename Real>
+cell_grid<T, Real>::cell_grid(std::vector<T> const& vec, double cell_size) : cell_size(cell_size)
+{
+    std::vector<std::array<double, 3>> positions;
+    positions.reserve(vec.size());
+    for (auto const& e : vec)
+        positions.push_back(static_cast<std::array<double, 3> const&>(e));
+
+    init(positions, [&vec](size_t i) -> T const&
+    { return vec[i]; });
+}
+
+template<class T, typename Real>
+cell_grid<T, Real>::cell_grid(
+    std::vector<std::array<double, 3>> const& positions, std::vector<T> const& ids, double cell_size) :
+    cell_size(cell_size)
+{
+    static_assert(std::is_unsigned_v<T>, "ids into a shared array of positions must be unsigned integers");
+
+    std::vector<std::array<double, 3>> subset;
+    subset.reserve(ids.size());
+    for (auto id : ids)
+        subset.push_back(positions[id]);
+
+    init(subset, [&ids](size_t i)
+    { return ids[i]; });
+}
+
+template<class T, typename Real>
+template<typename Element>
+void cell_grid<T, Real>::init(std::vector<std::array<double, 3>> const& positions, Element&& element)
+{
+    if (!(cell_size > 0) || !std::isfinite(cell_size))
+        throw std::invalid_argument("cell_grid: cell size must be positive, got " + std::to_string(cell_size));
+
+    if (positions.empty())
+        return;
+
+    std::array<double, 3> extent{};
+    origin = positions.front();
+    auto upper = positions.front();
+    for (auto const& p : positions)
+    {
+        for (size_t axis = 0; axis < 3; ++axis)
+        {
+            origin[axis] = std::min(origin[axis], p[axis]);
+            upper[axis] = std::max(upper[axis], p[axis]);
+        }
+    }
+
+    for (size_t axis = 0; axis < 3; ++axis)
+        extent[axis] = upper[axis] - origin[axis];
+
+    // sparse inputs (e.g. far-apart chains) would waste memory in empty cells: keep them O(n)
+    size_t const max_cells = 8 * positions.size() + 64;
+    while (true)
+    {
+        for (size_t axis = 0; axis < 3; ++axis)
+            dims[axis] = static_cast<size_t>(extent[axis] / cell_size) + 1;
+
+        if (dims[0] <= max_cells / dims[1] / dims[2])
+            break;
+
+        cell_size *= 2;
+    }
+
+    cell_first.assign(dims[0] * dims[1] * dims[2] + 1, 0);
+
+    std::vector<size_t> cells;
+    cells.reserve(positions.size());
+    for (auto const& p : positions)
+    {
+        cells.push_back(cell_of(p));
+        ++cell_first[cells.back() + 1];
+    }
+
+    for (size_t c = 1; c < cell_first.size(); ++c)
+        cell_first[c] += cell_first[c - 1];
+
+    std::vector<size_t> order(positions.size());
+    std::vector<size_t> next(cell_first.begin(), cell_first.end() - 1);
+    for (size_t i = 0; i < positions.size(); ++i)
+        order[next[cells[i]]++] = i;
+
+    elements.reserve(order.size());
+    coordinates.resize(3 * order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        elements.push_back(element(order[i]));
+        for (size_t axis = 0; axis < 3; ++axis)
+            coordinates[axis * order.size() + i] = static_cast<Real>(positions[order[i]][axis]);
+    }
+}
+
+template<class T, typename Real>
+bool cell_grid<T, Real>::cells_overlapping(
+    std::array<double, 3> const& lo, std::array<double, 3> const& hi,
+    std::array<size_t, 3>& low, std::array<size_t, 3>& high) const
+{
+    // the box is slightly enlarged so that rounding cannot leave out a cell
+    double const slack = 1e-9 * cell_size;
+
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        double const l = std::floor((lo[axis] - slack - origin[axis]) / cell_size);
+        double const h = std::floor((hi[axis] + slack - origin[axis]) / cell_size);
+
+        if (h < 0 || l >= static_cast<double>(dims[axis]))
+            return false;
+
+        low[axis] = l < 0 ? 0 : static_cast<size_t>(l);
+        high[axis] = std::min(static_cast<size_t>(h), dims[axis] - 1);
+    }
+
+    return true;
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void cell_grid<T, Real>::visit_range(std::array<double, 3> const& p, double range, Visitor&& visitor, size_t from) const
+{
+    if (elements.size() <= from)
+        return;
+
+    // the block of cells intersecting the (2*range)-edged cube around test
+    std::array<double, 3> lo{}, hi{};
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+        lo[axis] = p[axis] - range;
+        hi[axis] = p[axis] + range;
+    }
+
+    std::array<size_t, 3> low{}, high{};
+    if (!cells_overlapping(lo, hi, low, high))
+        return;
+
+    for (size_t z = low[2]; z <= high[2]; ++z)
+    {
+        for (size_t y = low[1]; y <= high[1]; ++y)
+        {
+            // cells along x are adjacent in memory: the whole row is scanned at once
+            size_t const row = (z * dims[1] + y) * dims[0];
+            size_t const first = std::max(cell_first[row + low[0]], from);
+            size_t const last = cell_first[row + high[0] + 1];
+
+            if (last <= first)
+                continue;
+
+            std::array<Real const*, 3> block;
+            for (size_t axis = 0; axis < 3; ++axis)
+                block[axis] = coordinates.data() + axis * elements.size() + first;
+
+            geom::for_each_within_radius<3>(
+                p, block, last - first, range,
+                [this, first, &p, range](size_t i)
+                { return distance(first + i, p) <= range; },
+                [first, &visitor](size_t i)
+                { visitor(first + i); });
+        }
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void cell_grid<T, Real>::for_each_in_range(kdpoint<3> const& test, double range, Visitor&& visitor) const
+{
+    visit_range(static_cast<std::array<double, 3> const&>(test), range, [this, &visitor](size_t i)
+    { visitor(elements[i]); });
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void cell_grid<T, Real>::for_each_pair_within(double range, Visitor&& visitor) const
+{
+    // each element only looks for the ones that come after it, i.e. in its own cell or in the following ones
+    for (size_t i = 0; i + 1 < elements.size(); ++i)
+    {
+        visit_range(position(i), range, [this, i, &visitor](size_t j)
+        { visitor(elements[i], elements[j]); }, i + 1);
+    }
+}
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void cell_grid<T, Real>::for_each_pair_within(cell_grid<U, Real> const& other, double range, Visitor&& visitor) const
+{ join(other, range, {}, std::forward<Visitor>(visitor)); }
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void cell_grid<T, Real>::join(
+    cell_grid<U, Real> const& other, double range, std::array<double, 3> const& offset, Visitor&& visitor) const
+{
+    if (elements.empty() || other.elements.empty())
+        return;
+
+    for (size_t z = 0; z < dims[2]; ++z)
+    {
+        for (size_t y = 0; y < dims[1]; ++y)
+        {
+            for (size_t x = 0; x < dims[0]; ++x)
+            {
+                size_t const c = (z * dims[1] + y) * dims[0] + x;
+                if (cell_first[c] == cell_first[c + 1])
+                    continue;
+
+                // the (translated) cell, enlarged by range
+                std::array<size_t, 3> const cell{x, y, z};
+                std::array<double, 3> lo{}, hi{};
+                for (size_t axis = 0; axis < 3; ++axis)
+                {
+                    lo[axis] = origin[axis] - offset[axis] + cell[axis] * cell_size - range;
+                    hi[axis] = origin[axis] - offset[axis] + (cell[axis] + 1) * cell_size + range;
+                }
+
+                std::array<size_t, 3> low{}, high{};
+                if (!other.cells_overlapping(lo, hi, low, high))
+                    continue;
+
+                for (size_t oz = low[2]; oz <= high[2]; ++oz)
+                {
+                    for (size_t oy = low[1]; oy <= high[1]; ++oy)
+                    {
+                        size_t const row = (oz * other.dims[1] + oy) * other.dims[0];
+                        size_t const first = other.cell_first[row + low[0]];
+                        size_t const last = other.cell_first[row + high[0] + 1];
+
+                        if (last == first)
+                            continue;
+
+                        std::array<Real const*, 3> block;
+                        for (size_t axis = 0; axis < 3; ++axis)
+                            block[axis] = other.coordinates.data() + axis * other.elements.size() + first;
+
+                        for (size_t i = cell_first[c]; i < cell_first[c + 1]; ++i)
+                        {
+                            T const& e = elements[i];
+                            auto const p = geom::difference<3>(position(i), offset);
+                            geom::for_each_within_radius<3>(
+                                p, block, last - first, range,
+                                [&other, first, &p, range](size_t j)
+                                { return other.distance(first + j, p) <= range; },
+                                [&other, first, &e, &visitor](size_t j)
+                                { visitor(e, other.elements[first + j]); });
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void cell_grid<T, Real>::for_each_in_range(
+    kdpoint<3> const& test, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("cell_grid: range is too large for the minimum image convention in this box");
+
+    auto const& p = static_cast<std::array<double, 3> const&>(test);
+    std::array<double, 3> const none{};
+
+    visit_range(p, range, [this, &visitor, &none](size_t i)
+    { visitor(elements[i], none); });
+
+    // e + shift is within range from p if and only if e is within range from p - shift
+    for (auto const& shift : box.neighbor_shifts())
+    {
+        visit_range(geom::difference<3>(p, shift), range, [this, &visitor, &shift](size_t i)
+        { visitor(elements[i], shift); });
+    }
+}
+
+template<class T, typename Real>
+template<typename Visitor>
+void cell_grid<T, Real>::for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("cell_grid: range is too large for the minimum image convention in this box");
+
+    std::array<double, 3> const none{};
+    for_each_pair_within(range, [&visitor, &none](T const& a, T const& b)
+    { visitor(a, b, none); });
+
+    // a pair across the boundary is seen with either shift or -shift: only one of them is tried
+    for (auto const& shift : box.neighbor_shifts(true))
+    {
+        join(*this, range, shift, [&visitor, &shift](T const& a, T const& b)
+        { visitor(a, b, shift); });
+    }
+}
+
+template<class T, typename Real>
+template<class U, typename Visitor>
+void cell_grid<T, Real>::for_each_pair_within(
+    cell_grid<U, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("cell_grid: range is too large for the minimum image convention in this box");
+
+    join(other, range, {}, [&visitor](T const& a, U const& b)
+    { visitor(a, b, std::array<double, 3>{}); });
+
+    for (auto const& shift : box.neighbor_shifts())
+    {
+        join(other, range, shift, [&visitor, &shift](T const& a, U const& b)
+        { visitor(a, b, shift); });
+    }
+}
+
+template<class T, typename Real>
+template<class Q>
+range_batch cell_grid<T, Real>::batch_range_search(std::vector<Q> const& queries, double range) const
+{
+    return batch::run<3>(
+        queries,
+        [this, &queries, range](geom::box<3> const& tile_box, std::vector<size_t> const& tile, auto const& emit)
+        {
+            if (elements.empty())
+                return;
+
+            // the block of cells intersecting the tile, enlarged by range
+            std::array<double, 3> lo{}, hi{};
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                lo[axis] = tile_box.lo[axis] - range;
+                hi[axis] = tile_box.hi[axis] + range;
+            }
+
+            std::array<size_t, 3> low{}, high{};
+            if (!cells_overlapping(lo, hi, low, high))
+                return;
+
+            for (size_t z = low[2]; z <= high[2]; ++z)
+            {
+                for (size_t y = low[1]; y <= high[1]; ++y)
+                {
+                    size_t const row = (z * dims[1] + y) * dims[0];
+                    size_t const first = cell_first[row + low[0]];
+                    size_t const last = cell_first[row + high[0] + 1];
+
+                    if (last == first)
+                        continue;
+
+                    std::array<Real const*, 3> block;
+                    for (size_t axis = 0; axis < 3; ++axis)
+                        block[axis] = coordinates.data() + axis * elements.size() + first;
+
+                    for (auto q : tile)
+                    {
+                        auto const& p = static_cast<std::array<double, 3> const&>(queries[q]);
+                        geom::for_each_within_radius<3>(
+                            p, block, last - first, range,
+                            [this, first, &p, range](size_t i)
+                            { return distance(first + i, p) <= range; },
+                            [first, &emit, q](size_t i)
+                            { emit(q, first + i); });
+                    }
+                }
+            }
+        });
+}
+
+template<class T, typename Real>
+void cell_grid<T, Real>::range_search(kdpoint<3> const& test, double range, std::vector<size_t>& neighbors) const
+{
+    neighbors.clear();
+    visit_range(static_cast<std::array<double, 3> const&>(test), range, [&neighbors](size_t i)
+    { neighbors.push_back(i); });
+}
+
+template<class T, typename Real>
+std::vector<T> cell_grid<T, Real>::range_search(kdpoint<3> const& test, double range) const
+{
+    std::vector<T> neighbors;
+    for_each_in_range(test, range, [&neighbors](T const& element)
+    { neighbors.push_back(element); });
+
+    return neighbors;
+}
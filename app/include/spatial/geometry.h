@@ -2,7 +2,15 @@
 
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 namespace geom
 {
@@ -101,6 +109,45 @@ double d_angle(std::array<double, K> const& v, std::array<double, K > const& w)
     return a > 90 ? 180 - a : a;
 }
 
+// Upper limit on an angle in degrees, precomputed for the tests below, which need no acos nor sqrt
+struct angle_limit
+{
+    // cos(limit) * |cos(limit)|: x * |x| is increasing, so it keeps the order of the cosines
+    double signed_cos2 = -std::numeric_limits<double>::infinity();
+
+    angle_limit() = default;
+
+    explicit angle_limit(double degrees)
+    {
+        if (degrees < 0)
+            signed_cos2 = std::numeric_limits<double>::infinity();
+        else if (degrees < 180)
+        {
+            double const c = std::cos(degrees * (PI_GRECO / 180.0));
+            signed_cos2 = c * std::abs(c);
+        }
+    }
+};
+
+// The same as angle(v, w) <= limit: cos(angle) = dot / (|v| |w|) is compared with cos(limit) through signed squares.
+// False if either vector is null, as the angle is undefined.
+template <size_t K>
+bool angle_within(std::array<double, K> const& v, std::array<double, K> const& w, angle_limit const& limit)
+{
+    double const d = dot(v, w);
+    double const norms = dot(v, v) * dot(w, w);
+    return norms > 0 && d * std::abs(d) >= limit.signed_cos2 * norms;
+}
+
+// The same as d_angle(v, w) <= limit: |cos(angle)| is compared with cos(limit) through squares
+template <size_t K>
+bool d_angle_within(std::array<double, K> const& v, std::array<double, K> const& w, angle_limit const& limit)
+{
+    double const d = dot(v, w);
+    double const norms = dot(v, v) * dot(w, w);
+    return norms > 0 && d * d >= limit.signed_cos2 * norms;
+}
+
 // The vector product is mathematically defined only between vectors in R^3
 inline static std::array<double, 3> cross(std::array<double, 3> const& v, std::array<double, 3> const& w)
 {
@@ -110,4 +157,522 @@ inline static std::array<double, 3> cross(std::array<double, 3> const& v, std::a
         (v[0] * w[1]) - (v[1] * w[0])
         });
 }
+
+// Axis-aligned box [lo, hi]
+template <size_t K>
+struct box
+{
+    std::array<double, K> lo;
+    std::array<double, K> hi;
+};
+
+// Smallest box containing both a and b
+template <size_t K>
+box<K> merge(box<K> const& a, box<K> const& b)
+{
+    box<K> m(a);
+    for (size_t i = 0; i < K; ++i)
+    {
+        m.lo[i] = std::min(a.lo[i], b.lo[i]);
+        m.hi[i] = std::max(a.hi[i], b.hi[i]);
+    }
+
+    return m;
+}
+
+// Squared distance between the closest points of two boxes (0 if they overlap)
+template <size_t K>
+double squared_distance(box<K> const& a, box<K> const& b)
+{
+    double sum = 0;
+    for (size_t i = 0; i < K; ++i)
+    {
+        double const gap = std::max({a.lo[i] - b.hi[i], b.lo[i] - a.hi[i], 0.0});
+        sum += gap * gap;
+    }
+
+    return sum;
+}
+
+// Periodic box spanned by three lattice vectors (orthorhombic or triclinic)
+struct lattice
+{
+    std::array<std::array<double, 3>, 3> vectors;
+
+    // Translation by i, j and k times the lattice vectors
+    std::array<double, 3> shift(int i, int j, int k) const
+    {
+        std::array<double, 3> s({});
+        for (size_t axis = 0; axis < 3; ++axis)
+            s[axis] = i * vectors[0][axis] + j * vectors[1][axis] + k * vectors[2][axis];
+
+        return s;
+    }
+
+    // Translations to the 26 neighboring images; with one_per_pair, only one of s and -s for each of them (13)
+    std::vector<std::array<double, 3>> neighbor_shifts(bool one_per_pair = false) const
+    {
+        std::vector<std::array<double, 3>> shifts;
+        for (int i = -1; i <= 1; ++i)
+            for (int j = -1; j <= 1; ++j)
+                for (int k = -1; k <= 1; ++k)
+                    if ((i != 0 || j != 0 || k != 0) && (!one_per_pair || i > 0 || (i == 0 && (j > 0 || (j == 0 && k > 0)))))
+                        shifts.push_back(shift(i, j, k));
+
+        return shifts;
+    }
+
+    // Smallest distance between opposite faces: the minimum image convention holds for distances up to half of it
+    double min_width() const
+    {
+        double const volume = std::abs(dot<3>(vectors[0], cross(vectors[1], vectors[2])));
+        return volume / std::max({
+            magnitude<3>(cross(vectors[1], vectors[2])),
+            magnitude<3>(cross(vectors[2], vectors[0])),
+            magnitude<3>(cross(vectors[0], vectors[1]))});
+    }
+};
+
+namespace detail
+{
+// Vectorized part of for_each_within_squared_radius: it scans the points in groups of SIMD lanes,
+// and returns how many of them it has scanned (the tail is left to the caller).
+template <size_t K, typename Hit>
+size_t scan_within_squared_radius(
+    std::array<double, K> const& p, std::array<double const*, K> const& block, size_t n, double r2, Hit& hit)
+{
+    size_t i = 0;
+
+#if defined(__AVX__)
+    __m256d const threshold = _mm256_set1_pd(r2);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d d2 = _mm256_setzero_pd();
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            __m256d const d = _mm256_sub_pd(_mm256_loadu_pd(block[axis] + i), _mm256_set1_pd(p[axis]));
+            d2 = _mm256_add_pd(d2, _mm256_mul_pd(d, d));
+        }
+
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(d2, threshold, _CMP_LE_OQ));
+        if (mask != 0)
+        {
+            alignas(32) double lanes[4];
+            _mm256_store_pd(lanes, d2);
+            for (size_t lane = 0; mask != 0; ++lane, mask >>= 1)
+                if (mask & 1)
+                    hit(i + lane, lanes[lane]);
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d const threshold = _mm_set1_pd(r2);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d d2 = _mm_setzero_pd();
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            __m128d const d = _mm_sub_pd(_mm_loadu_pd(block[axis] + i), _mm_set1_pd(p[axis]));
+            d2 = _mm_add_pd(d2, _mm_mul_pd(d, d));
+        }
+
+        int mask = _mm_movemask_pd(_mm_cmple_pd(d2, threshold));
+        if (mask != 0)
+        {
+            alignas(16) double lanes[2];
+            _mm_store_pd(lanes, d2);
+            for (size_t lane = 0; mask != 0; ++lane, mask >>= 1)
+                if (mask & 1)
+                    hit(i + lane, lanes[lane]);
+        }
+    }
+#endif
+
+    return i;
+}
+
+// Single precision: twice the lanes of the double precision scan
+template <size_t K, typename Hit>
+size_t scan_within_squared_radius(
+    std::array<double, K> const& p, std::array<float const*, K> const& block, size_t n, double r2, Hit& hit)
+{
+    size_t i = 0;
+
+#if defined(__AVX__)
+    __m256 const threshold = _mm256_set1_ps(static_cast<float>(r2));
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 d2 = _mm256_setzero_ps();
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            __m256 const d = _mm256_sub_ps(_mm256_loadu_ps(block[axis] + i), _mm256_set1_ps(static_cast<float>(p[axis])));
+            d2 = _mm256_add_ps(d2, _mm256_mul_ps(d, d));
+        }
+
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, threshold, _CMP_LE_OQ));
+        if (mask != 0)
+        {
+            alignas(32) float lanes[8];
+            _mm256_store_ps(lanes, d2);
+            for (size_t lane = 0; mask != 0; ++lane, mask >>= 1)
+                if (mask & 1)
+                    hit(i + lane, lanes[lane]);
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 const threshold = _mm_set1_ps(static_cast<float>(r2));
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 d2 = _mm_setzero_ps();
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            __m128 const d = _mm_sub_ps(_mm_loadu_ps(block[axis] + i), _mm_set1_ps(static_cast<float>(p[axis])));
+            d2 = _mm_add_ps(d2, _mm_mul_ps(d, d));
+        }
+
+        int mask = _mm_movemask_ps(_mm_cmple_ps(d2, threshold));
+        if (mask != 0)
+        {
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, d2);
+            for (size_t lane = 0; mask != 0; ++lane, mask >>= 1)
+                if (mask & 1)
+                    hit(i + lane, lanes[lane]);
+        }
+    }
+#endif
+
+    return i;
+}
+}
+
+// Squared-distance scan of a block of n points stored axis by axis (structure of arrays):
+// the axis-th coordinate of the i-th point is block[axis][i], either a double or a float.
+// It calls hit(i, d2) for every point such that d2 = |p - point_i|^2 <= r2, in increasing order of i;
+// with floats, p is rounded to float and squared distances are computed in single precision.
+template <size_t K, typename Real, typename Hit>
+void for_each_within_squared_radius(
+    std::array<double, K> const& p, std::array<Real const*, K> const& block, size_t n, double r2, Hit&& hit)
+{
+    size_t i = detail::scan_within_squared_radius<K>(p, block, n, r2, hit);
+
+    // scalar fallback (and tail of the vectorized loops), with the same arithmetic
+    Real const threshold = static_cast<Real>(r2);
+    for (; i < n; ++i)
+    {
+        Real d2 = 0;
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            Real const d = block[axis][i] - static_cast<Real>(p[axis]);
+            d2 += d * d;
+        }
+
+        if (d2 <= threshold)
+            hit(i, d2);
+    }
+}
+
+// As above, but it calls hit(i) for every point within distance r from p.
+// The scan works on squared distances: the few points that are too close to the boundary to be told apart by rounding
+// are passed to exact(i), which decides whether they are in.
+template <size_t K, typename Real, typename Exact, typename Hit>
+void for_each_within_radius(
+    std::array<double, K> const& p, std::array<Real const*, K> const& block, size_t n, double r,
+    Exact&& exact, Hit&& hit)
+{
+    // rounding p and the differences to Real is off by about epsilon times the magnitude of the coordinates
+    // (at most |p| + r for the points near the boundary), and that error is multiplied by up to 2r in d2
+    double magnitude = 0;
+    for (size_t axis = 0; axis < K; ++axis)
+        magnitude = std::max(magnitude, std::abs(p[axis]));
+
+    double const r2 = r * r;
+    double const slack = 4 * K * std::numeric_limits<Real>::epsilon() * r * (magnitude + 2 * r);
+    double const r2_low = r2 - slack;
+    double const r2_high = r2 + slack;
+
+    for_each_within_squared_radius<K>(p, block, n, r2_high, [&exact, &hit, r2_low](size_t i, double d2)
+    {
+        if (d2 <= r2_low || exact(i))
+            hit(i);
+    });
+}
+
+// At most N points of R^3, stored axis by axis in blocks of SIMD lanes (structure of arrays).
+// Lanes past size hold copies of the first point, so that they never change a minimum distance.
+template <size_t N>
+struct point_block
+{
+    static constexpr size_t capacity = N;
+    static constexpr size_t lanes = (N + 3) / 4 * 4;
+
+    // coordinates[axis][i] is the axis-th coordinate of the i-th point
+    alignas(32) std::array<std::array<double, lanes>, 3> coordinates{};
+    size_t size = 0;
+
+    point_block() = default;
+
+    template <typename Points>
+    explicit point_block(Points const& points) : size(points.size())
+    {
+        if (size == 0 || size > N)
+            throw std::invalid_argument("point_block: between 1 and " + std::to_string(N) + " points are needed");
+
+        size_t i = 0;
+        for (auto const& p : points)
+        {
+            auto const& position = static_cast<std::array<double, 3> const&>(p);
+            for (size_t axis = 0; axis < 3; ++axis)
+                coordinates[axis][i] = position[axis];
+            ++i;
+        }
+
+        for (; i < lanes; ++i)
+            for (size_t axis = 0; axis < 3; ++axis)
+                coordinates[axis][i] = coordinates[axis][0];
+    }
+};
+
+// Smallest squared distance between a point of a and a point of b: every point of a is compared with all the lanes
+// of b at once, and the minimum is only reduced across lanes at the end.
+template <size_t N>
+double min_squared_distance(point_block<N> const& a, point_block<N> const& b)
+{
+    constexpr size_t lanes = point_block<N>::lanes;
+
+#if defined(__AVX__)
+    __m256d minimum = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < a.size; ++i)
+    {
+        for (size_t j = 0; j < lanes; j += 4)
+        {
+            __m256d d2 = _mm256_setzero_pd();
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                __m256d const d = _mm256_sub_pd(
+                    _mm256_load_pd(b.coordinates[axis].data() + j), _mm256_set1_pd(a.coordinates[axis][i]));
+                d2 = _mm256_add_pd(d2, _mm256_mul_pd(d, d));
+            }
+            minimum = _mm256_min_pd(minimum, d2);
+        }
+    }
+
+    __m128d const half = _mm_min_pd(_mm256_castpd256_pd128(minimum), _mm256_extractf128_pd(minimum, 1));
+    return _mm_cvtsd_f64(_mm_min_sd(half, _mm_unpackhi_pd(half, half)));
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d minimum = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < a.size; ++i)
+    {
+        for (size_t j = 0; j < lanes; j += 2)
+        {
+            __m128d d2 = _mm_setzero_pd();
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                __m128d const d = _mm_sub_pd(
+                    _mm_load_pd(b.coordinates[axis].data() + j), _mm_set1_pd(a.coordinates[axis][i]));
+                d2 = _mm_add_pd(d2, _mm_mul_pd(d, d));
+            }
+            minimum = _mm_min_pd(minimum, d2);
+        }
+    }
+
+    return _mm_cvtsd_f64(_mm_min_sd(minimum, _mm_unpackhi_pd(minimum, minimum)));
+#else
+    double minimum = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < a.size; ++i)
+    {
+        for (size_t j = 0; j < lanes; ++j)
+        {
+            double d2 = 0;
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                double const d = b.coordinates[axis][j] - a.coordinates[axis][i];
+                d2 += d * d;
+            }
+            minimum = std::min(minimum, d2);
+        }
+    }
+
+    return minimum;
+#endif
+}
+
+// Structure of arrays of points of R^K, for the batch distances below:
+// the axis-th coordinate of the i-th point is coordinates[axis * size() + i].
+template <size_t K>
+class point_array
+{
+    std::vector<double> coordinates;
+    size_t count = 0;
+
+public:
+    point_array() = default;
+
+    explicit point_array(size_t n) : coordinates(K * n), count(n)
+    {}
+
+    template <typename Points>
+    explicit point_array(Points const& points) : point_array(points.size())
+    {
+        size_t i = 0;
+        for (auto const& p : points)
+        {
+            auto const& position = static_cast<std::array<double, K> const&>(p);
+            for (size_t axis = 0; axis < K; ++axis)
+                coordinates[axis * count + i] = position[axis];
+            ++i;
+        }
+    }
+
+    [[nodiscard]]
+    size_t size() const
+    { return count; }
+
+    [[nodiscard]]
+    std::array<double, K> operator[](size_t i) const
+    {
+        std::array<double, K> p{};
+        for (size_t axis = 0; axis < K; ++axis)
+            p[axis] = coordinates[axis * count + i];
+
+        return p;
+    }
+
+    // the points axis by axis, as taken by distances
+    [[nodiscard]]
+    std::array<double const*, K> axes() const
+    {
+        std::array<double const*, K> block{};
+        for (size_t axis = 0; axis < K; ++axis)
+            block[axis] = coordinates.data() + axis * count;
+
+        return block;
+    }
+};
+
+namespace detail
+{
+// The SIMD lanes of the batch distances, and a single lane with the same arithmetic for the scalar fallback
+// (and for the tails of the vectorized loops).
+struct scalar_lanes
+{
+    static constexpr size_t width = 1;
+    double v;
+
+    static scalar_lanes load(double const* p)
+    { return {*p}; }
+
+    static scalar_lanes set(double x)
+    { return {x}; }
+
+    void store(double* p) const
+    { *p = v; }
+
+    friend scalar_lanes operator+(scalar_lanes a, scalar_lanes b)
+    { return {a.v + b.v}; }
+
+    friend scalar_lanes operator-(scalar_lanes a, scalar_lanes b)
+    { return {a.v - b.v}; }
+
+    friend scalar_lanes operator*(scalar_lanes a, scalar_lanes b)
+    { return {a.v * b.v}; }
+
+    friend scalar_lanes sqrt(scalar_lanes a)
+    { return {std::sqrt(a.v)}; }
+};
+
+#if defined(__AVX__)
+struct simd_lanes
+{
+    static constexpr size_t width = 4;
+    __m256d v;
+
+    static simd_lanes load(double const* p)
+    { return {_mm256_loadu_pd(p)}; }
+
+    static simd_lanes set(double x)
+    { return {_mm256_set1_pd(x)}; }
+
+    void store(double* p) const
+    { _mm256_storeu_pd(p, v); }
+
+    friend simd_lanes operator+(simd_lanes a, simd_lanes b)
+    { return {_mm256_add_pd(a.v, b.v)}; }
+
+    friend simd_lanes operator-(simd_lanes a, simd_lanes b)
+    { return {_mm256_sub_pd(a.v, b.v)}; }
+
+    friend simd_lanes operator*(simd_lanes a, simd_lanes b)
+    { return {_mm256_mul_pd(a.v, b.v)}; }
+
+    friend simd_lanes sqrt(simd_lanes a)
+    { return {_mm256_sqrt_pd(a.v)}; }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+struct simd_lanes
+{
+    static constexpr size_t width = 2;
+    __m128d v;
+
+    static simd_lanes load(double const* p)
+    { return {_mm_loadu_pd(p)}; }
+
+    static simd_lanes set(double x)
+    { return {_mm_set1_pd(x)}; }
+
+    void store(double* p) const
+    { _mm_storeu_pd(p, v); }
+
+    friend simd_lanes operator+(simd_lanes a, simd_lanes b)
+    { return {_mm_add_pd(a.v, b.v)}; }
+
+    friend simd_lanes operator-(simd_lanes a, simd_lanes b)
+    { return {_mm_sub_pd(a.v, b.v)}; }
+
+    friend simd_lanes operator*(simd_lanes a, simd_lanes b)
+    { return {_mm_mul_pd(a.v, b.v)}; }
+
+    friend simd_lanes sqrt(simd_lanes a)
+    { return {_mm_sqrt_pd(a.v)}; }
+};
+#else
+using simd_lanes = scalar_lanes;
+#endif
+
+// Runs kernel(lanes, i) over [0, n): in groups of SIMD lanes first, then one by one
+template <typename Kernel>
+void for_each_lane_group(size_t n, Kernel&& kernel)
+{
+    size_t i = 0;
+    for (; i + simd_lanes::width <= n; i += simd_lanes::width)
+        kernel(simd_lanes{}, i);
+    for (; i < n; ++i)
+        kernel(scalar_lanes{}, i);
+}
+
+template <typename Lanes, size_t K>
+Lanes squared_distance(std::array<double const*, K> const& a, std::array<double const*, K> const& b, size_t i)
+{
+    Lanes d2 = Lanes::set(0);
+    for (size_t axis = 0; axis < K; ++axis)
+    {
+        Lanes const d = Lanes::load(a[axis] + i) - Lanes::load(b[axis] + i);
+        d2 = d2 + d * d;
+    }
+
+    return d2;
+}
+}
+
+// Distances |a_i - b_i| between two sequences of n points stored axis by axis (structure of arrays, see point_array):
+// the axis-th coordinate of the i-th point of a is a[axis][i], and the i-th distance is stored in out[i].
+// It computes the same as distance, a group of SIMD lanes at a time.
+template <size_t K>
+void distances(std::array<double const*, K> const& a, std::array<double const*, K> const& b, size_t n, double* out)
+{
+    detail::for_each_lane_group(n, [&](auto lanes, size_t i)
+    {
+        using Lanes = decltype(lanes);
+        sqrt(detail::squared_distance<Lanes, K>(a, b, i)).store(out + i);
+    });
+}
 }
@@ -1,149 +1,858 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "kdpoint.h"
+#include "range_batch.h"
+
+/**
+ * Threads that build subtrees of a kdtree concurrently with their siblings, shared by all the trees of the process
+ * (which may be built concurrently themselves): at most one less than the hardware threads are busy at any time,
+ * and a subtree that finds none left is built by the thread that reached it.
+ */
+namespace build_threads
+{
+inline std::atomic<unsigned> busy{0};
+
+inline unsigned limit()
+{
+    static unsigned const threads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    return threads;
+}
+
+// takes one thread of the budget, if any is left
+inline bool try_acquire()
+{
+    unsigned n = busy.load();
+    while (n < limit())
+    {
+        if (busy.compare_exchange_weak(n, n + 1))
+            return true;
+    }
+
+    return false;
+}
 
-template<class T, size_t K>
+inline void release()
+{ --busy; }
+}
+
+/**
+ * Pointer-free, bucketed kd-tree.
+ * <br/>
+ * <br/>
+ * All the elements live in one contiguous array, and their coordinates in a parallel structure of arrays.
+ * Elements are either points themselves (kdpoint<K>), or ids into a shared array of positions:
+ * in the latter case, the tree only stores the ids and the coordinates needed to scan the leaves.
+ * Coordinates are stored as Real: with float, they take half the memory (and bandwidth) of doubles,
+ * and distances are only as exact as the rounded coordinates (about 1e-5 Å for protein-sized boxes).
+ * The subtree spanning the half-open range [first, last) is a leaf (bucket) if it holds at most bucket_size elements;
+ * otherwise it is split at m = (first + last) / 2 into [first, m) and [m, last),
+ * so that the coordinates along its splitting axis are <= split on the left and >= split on the right.
+ * <br/>
+ * Nodes are numbered in heap order (children of i are 2i+1 and 2i+2); the splitting axis of a node is its depth modulo K.
+ * <br/>
+ * Every node, leaves included, stores the bounding box of its elements, and traversals prune with those boxes
+ * rather than with split values: boxes stay valid when the elements move, as long as they are refitted (see refit),
+ * so a tree can follow small displacements (e.g. the frames of a trajectory) without being rebuilt.
+ */
+template<class T, size_t K, typename Real = double>
 class kdtree
 {
+    static_assert(std::is_floating_point_v<Real>, "coordinates must be stored as floating point numbers");
+
+    // joins need to look into trees of other element types
+    template<class, size_t, typename>
+    friend class kdtree;
+
 public:
-    class node;
+    static constexpr size_t default_bucket_size = 8;
+
+    // subtrees at least this big are built concurrently with their sibling, while build_threads has any left
+    static constexpr size_t default_parallel_threshold = size_t{1} << 16;
+
+    // refit rebuilds the tree once its boxes have grown by more than this factor since it was built
+    static constexpr double default_max_growth = 1.5;
+
+    // edges of the boxes are at least this fraction of the largest coordinate when their growth is measured, so
+    // that the layouts of coincident elements, whose boxes are points, are not rebuilt at every displacement
+    static constexpr double min_edge_ratio = 1e-5;
 
 private:
-    node* root;
+    std::vector<T> elements;
+
+    // coordinates[axis * size() + i] is the axis-th coordinate of elements[i]
+    std::vector<Real> coordinates;
+
+    // bounding boxes of all the nodes, in heap order
+    std::vector<geom::box<K>> bounds;
+
+    size_t bucket_size = default_bucket_size;
+
+    size_t parallel_threshold = default_parallel_threshold;
+
+    // shortest edge of the boxes whose growth is measured, set by the last build (see min_edge_ratio)
+    double min_box_edge = 0;
+
+    // quality of the layout, as computed by margin(min_box_edge) right after the last build
+    double built_margin = 0;
+
+    // a subtree is identified by its range in the elements array, its depth and its heap index
+    struct span
+    {
+        size_t first;
+        size_t last;
+        size_t depth;
+        size_t node;
+
+        [[nodiscard]]
+        size_t median() const
+        { return first + (last - first) / 2; }
+
+        [[nodiscard]]
+        span left() const
+        { return {first, median(), depth + 1, 2 * node + 1}; }
+
+        [[nodiscard]]
+        span right() const
+        { return {median(), last, depth + 1, 2 * node + 2}; }
+    };
+
+    // traversals never keep more than one pending sibling per level
+    static constexpr size_t max_height = 8 * sizeof(size_t);
+
+    [[nodiscard]]
+    bool is_leaf(span const& s) const
+    { return s.last - s.first <= bucket_size; }
+
+    // the biggest subtree of n elements is always the right one, with n - n/2 elements
+    static size_t height(size_t n, size_t bucket_size)
+    {
+        size_t h = 1;
+        for (; n > bucket_size; n -= n / 2)
+            ++h;
+
+        return h;
+    }
+
+    // places the median of s (along its splitting axis) at the beginning of its right subtree
+    void build(
+        std::vector<std::array<double, K>> const& positions, std::vector<size_t>& order, span const& s,
+        size_t parallel_threshold);
+
+    // computes the bounding boxes of s and of all its descendants from the coordinates
+    geom::box<K> fit_bounds(span const& s);
+
+    // sum of the edges of all the boxes, each one at least min_edge: it grows as the elements of each subtree
+    // drift apart
+    [[nodiscard]]
+    double margin(double min_edge = 0) const;
+
+    // lays out the elements: element(i) is the i-th one, at positions[i]
+    template<typename Element>
+    void init(std::vector<std::array<double, K>> const& positions, Element&& element, size_t parallel_threshold);
+
+    [[nodiscard]]
+    std::array<double, K> position(size_t i) const
+    {
+        std::array<double, K> p{};
+        for (size_t axis = 0; axis < K; ++axis)
+            p[axis] = coordinates[axis * elements.size() + i];
+
+        return p;
+    }
+
+    // the same as kdpoint::distance, computed from the stored coordinates
+    [[nodiscard]]
+    double distance(size_t i, std::array<double, K> const& p) const
+    { return geom::distance<K>(position(i), p); }
+
+    // calls visitor(i) for each element i >= from within range from p
+    template<typename Visitor>
+    void visit_range(std::array<double, K> const& p, double range, Visitor&& visitor, size_t from = 0) const;
+
+    // dual-tree join of this tree, translated by -offset, with the other one
+    template<class U, typename Visitor>
+    void join(kdtree<U, K, Real> const& other, double range, std::array<double, K> const& offset, Visitor&& visitor) const;
+
+    // positions of the (at most) k elements nearest to test within range, from the nearest one
+    std::vector<size_t> nearest(kdpoint<K> const& test, size_t k, double range) const;
+
+    // builds the tree from scratch, keeping the elements it has
+    void rebuild(std::vector<std::array<double, K>> const& positions);
 
 public:
     // shallow copy: O(1)
-    kdtree& operator=(kdtree&&) noexcept;
+    kdtree& operator=(kdtree&&) noexcept = default;
 
     // shallow copy: O(1)
-    kdtree(kdtree&&) noexcept;
+    kdtree(kdtree&&) noexcept = default;
 
-    // balanced build: O(n log^2 n)
-    explicit kdtree(std::vector<T>&);
+    // balanced build: O(n log n) work, with the two halves of subtrees of at least parallel_threshold elements
+    // built on separate threads (see build_threads)
+    explicit kdtree(
+        std::vector<T> const&,
+        size_t bucket_size = default_bucket_size,
+        size_t parallel_threshold = default_parallel_threshold);
 
-    kdtree() : root(nullptr)
-    {};
+    // as above, but over a subset of a shared array of positions: the element ids[i] is at positions[ids[i]],
+    // and T must be an unsigned integer type
+    kdtree(
+        std::vector<std::array<double, K>> const& positions,
+        std::vector<T> const& ids,
+        size_t bucket_size = default_bucket_size,
+        size_t parallel_threshold = default_parallel_threshold);
+
+    kdtree() = default;
 
     // O(n)
-    ~kdtree();
+    ~kdtree() = default;
 
     // range search in a (2*range)-edged cube O(log n)
     std::vector<T> range_search(kdpoint<K> const& test, double range) const;
 
-    node* get_root() const
-    { return root; }
+    // as above, but it stores the positions of the neighbors (see operator[]) in a caller-owned buffer
+    void range_search(kdpoint<K> const& test, double range, std::vector<size_t>& neighbors) const;
+
+    // as above, but it calls visitor(T const&) on each neighbor without copying it
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<K> const& test, double range, Visitor&& visitor) const;
+
+    // self-join: it calls visitor(T const& a, T const& b) exactly once for each unordered pair of distinct elements
+    // within range from each other (a is the one that comes first in storage order)
+    template<typename Visitor>
+    void for_each_pair_within(double range, Visitor&& visitor) const;
+
+    // dual-tree join: it calls visitor(T const& a, U const& b) for each pair of elements, a from this tree and b from
+    // the other one, within range from each other; both trees are descended together,
+    // discarding pairs of subtrees whose bounding boxes are farther than range
+    template<class U, typename Visitor>
+    void for_each_pair_within(kdtree<U, K, Real> const& other, double range, Visitor&& visitor) const;
+
+    // minimum-image range search in a periodic box, for range up to half of box.min_width():
+    // it calls visitor(T const& e, std::array<double, K> const& shift) for each element whose image e + shift
+    // is within range from test
+    template<typename Visitor>
+    void for_each_in_range(kdpoint<K> const& test, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    // periodic self-join: it calls visitor(T const& a, T const& b, std::array<double, K> const& shift) exactly once
+    // for each unordered pair of distinct elements such that a and b + shift are within range from each other
+    template<typename Visitor>
+    void for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    // periodic join: as above, with a from this tree and b from the other one
+    template<class U, typename Visitor>
+    void for_each_pair_within(
+        kdtree<U, K, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const;
+
+    // batch of range searches: queries are sorted in Z-order and run in tiles that share one traversal of the tree;
+    // the neighbors (see operator[]) are grouped per query, in the same order of queries
+    template<class Q>
+    range_batch batch_range_search(std::vector<Q> const& queries, double range) const;
+
+    // the k elements nearest to test (all of them if there are fewer than k), from the nearest one;
+    // it only keeps k candidates at a time, in a bounded priority queue
+    std::vector<T> knn(kdpoint<K> const& test, size_t k) const;
+
+    // as above, but only among the elements within range from test
+    std::vector<T> knn(kdpoint<K> const& test, size_t k, double range) const;
+
+    [[nodiscard]]
+    T const& operator[](size_t i) const
+    { return elements[i]; }
+
+    [[nodiscard]]
+    size_t size() const
+    { return elements.size(); }
+
+    // number of levels, leaves included: O(log n)
+    [[nodiscard]]
+    size_t height() const
+    { return height(elements.size(), bucket_size); }
+
+    // moves every element e to position_of(e) (an std::array<double, K>) and refits the boxes, in O(n),
+    // keeping the layout; if the boxes end up more than max_growth times larger than right after the last build,
+    // the tree is rebuilt instead. It returns true if it was rebuilt.
+    // Only for trees of ids into a shared array of positions: elements that are points would keep their old coordinates.
+    template<typename Position>
+    bool refit(Position&& position_of, double max_growth = default_max_growth);
 };
 
-template<class T, size_t K>
-class kdtree<T, K>::node
+template<class T, size_t K, typename Real>
+void kdtree<T, K, Real>::build(
+    std::vector<std::array<double, K>> const& positions, std::vector<size_t>& order, span const& s,
+    size_t parallel_threshold)
 {
-public:
-    T element;
+    size_t const median = s.median();
+    size_t const axis = s.depth % K;
+
+    // linear-time selection: O(n) work per level of the tree
+    std::nth_element(
+        order.begin() + s.first, order.begin() + median, order.begin() + s.last,
+        [&positions, axis](size_t a, size_t b)
+        { return positions[a][axis] < positions[b][axis]; });
+
+    // the two subtrees work on disjoint ranges of order and disjoint nodes, so they can be built concurrently
+    std::future<void> left;
+    if (!is_leaf(s.left()))
+    {
+        if (s.last - s.first >= parallel_threshold && build_threads::try_acquire())
+        {
+            left = std::async(std::launch::async, [this, &positions, &order, &s, parallel_threshold]
+            {
+                build(positions, order, s.left(), parallel_threshold);
+                build_threads::release();
+            });
+        }
+        else
+            build(positions, order, s.left(), parallel_threshold);
+    }
 
-    node* left;
-    node* right;
+    if (!is_leaf(s.right()))
+        build(positions, order, s.right(), parallel_threshold);
 
-    // balanced build: O(n log^2 n)
-    node(std::vector<T>&, size_t, size_t, size_t);
+    if (left.valid())
+        left.get();
+}
 
-    // O(n)
-    ~node();
+template<class T, size_t K, typename Real>
+kdtree<T, K, Real>::kdtree(std::vector<T> const& vec, size_t bucket_size, size_t parallel_threshold) :
+    bucket_size(std::max<size_t>(bucket_size, 1))
+{
+    std::vector<std::array<double, K>> positions;
+    positions.reserve(vec.size());
+    for (auto const& e : vec)
+        positions.push_back(static_cast<std::array<double, K> const&>(e));
 
-    // range search in a (2*range)-edged cube: O(log n)
-    void range_search(kdpoint<K> const&, double, size_t, std::vector<T>&) const;
-};
+    init(positions, [&vec](size_t i) -> T const&
+    { return vec[i]; }, parallel_threshold);
+}
+
+template<class T, size_t K, typename Real>
+kdtree<T, K, Real>::kdtree(
+    std::vector<std::array<double, K>> const& positions, std::vector<T> const& ids,
+    size_t bucket_size, size_t parallel_threshold) :
+    bucket_size(std::max<size_t>(bucket_size, 1))
+{
+    static_assert(std::is_unsigned_v<T>, "ids into a shared array of positions must be unsigned integers");
 
-template<class T, size_t K>
-kdtree<T, K>& kdtree<T, K>::operator=(kdtree<T, K>&& other) noexcept
+    std::vector<std::array<double, K>> subset;
+    subset.reserve(ids.size());
+    for (auto id : ids)
+        subset.push_back(positions[id]);
+
+    init(subset, [&ids](size_t i)
+    { return ids[i]; }, parallel_threshold);
+}
+
+template<class T, size_t K, typename Real>
+template<typename Element>
+void kdtree<T, K, Real>::init(
+    std::vector<std::array<double, K>> const& positions, Element&& element, size_t parallel_threshold)
 {
-    if (this != &other)
+    // the layout is computed over a permutation of indices,
+    // so that every element is copied exactly once, at the very end
+    std::vector<size_t> order(positions.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    this->parallel_threshold = parallel_threshold;
+
+    span const root{0, order.size(), 0, 0};
+    if (!is_leaf(root))
+        build(positions, order, root, parallel_threshold);
+
+    elements.reserve(order.size());
+    coordinates.resize(K * order.size());
+    for (size_t i = 0; i < order.size(); ++i)
     {
-        root = other.root;
-        other.root = nullptr;
+        elements.push_back(element(order[i]));
+        for (size_t axis = 0; axis < K; ++axis)
+            coordinates[axis * order.size() + i] = static_cast<Real>(positions[order[i]][axis]);
     }
 
-    return *this;
+    if (!elements.empty())
+    {
+        bounds.resize((size_t{1} << height()) - 1);
+        fit_bounds(root);
+
+        // the coordinates are in no particular unit: their magnitude is read from the box of the root
+        double scale = 0;
+        for (size_t axis = 0; axis < K; ++axis)
+            scale = std::max({scale, std::abs(bounds[0].lo[axis]), std::abs(bounds[0].hi[axis])});
+
+        min_box_edge = min_edge_ratio * scale;
+    }
+
+    built_margin = margin(min_box_edge);
 }
 
-template<class T, size_t K>
-kdtree<T, K>::kdtree(kdtree<T, K>&& other) noexcept : root(other.root)
-{ other.root = nullptr; }
+template<class T, size_t K, typename Real>
+geom::box<K> kdtree<T, K, Real>::fit_bounds(span const& s)
+{
+    if (!is_leaf(s))
+        return bounds[s.node] = geom::merge(fit_bounds(s.left()), fit_bounds(s.right()));
 
-template<class T, size_t K>
-kdtree<T, K>::kdtree(std::vector<T>& vec)
-{ root = vec.empty() ? nullptr : new node(vec, 0, vec.size() - 1, 0); }
+    geom::box<K> b;
+    for (size_t axis = 0; axis < K; ++axis)
+    {
+        auto const first = coordinates.begin() + axis * elements.size() + s.first;
+        auto const [lo, hi] = std::minmax_element(first, first + (s.last - s.first));
 
-template<class T, size_t K>
-kdtree<T, K>::~kdtree()
-{ delete root; }
+        b.lo[axis] = *lo;
+        b.hi[axis] = *hi;
+    }
 
-template<class T, size_t K>
-std::vector<T> kdtree<T, K>::range_search(kdpoint<K> const& test, double range) const
+    return bounds[s.node] = b;
+}
+
+template<class T, size_t K, typename Real>
+double kdtree<T, K, Real>::margin(double min_edge) const
 {
-    std::vector<T> neighbors;
+    if (elements.empty())
+        return 0;
 
-    if (root != nullptr)
-        root->range_search(test, range, 0, neighbors);
+    // only the nodes that exist: the heap has holes where leaves are shallower than the deepest ones
+    double sum = 0;
 
-    return neighbors;
+    std::array<span, max_height> stack;
+    size_t top = 0;
+
+    stack[top++] = {0, elements.size(), 0, 0};
+    while (top > 0)
+    {
+        span const s = stack[--top];
+        for (size_t axis = 0; axis < K; ++axis)
+            sum += std::max(bounds[s.node].hi[axis] - bounds[s.node].lo[axis], min_edge);
+
+        if (!is_leaf(s))
+        {
+            stack[top++] = s.right();
+            stack[top++] = s.left();
+        }
+    }
+
+    return sum;
+}
+
+template<class T, size_t K, typename Real>
+void kdtree<T, K, Real>::rebuild(std::vector<std::array<double, K>> const& positions)
+{
+    std::vector<T> old;
+    old.swap(elements);
+
+    coordinates.clear();
+    bounds.clear();
+
+    init(positions, [&old](size_t i)
+    { return old[i]; }, parallel_threshold);
 }
 
-template<typename X>
-X const& sort_and_take_median(std::vector<X>& vec, size_t first, size_t last, size_t depth)
+template<class T, size_t K, typename Real>
+template<typename Position>
+bool kdtree<T, K, Real>::refit(Position&& position_of, double max_growth)
 {
-    auto const cmp = [depth](X const& a, X const& b)
-    { return a[depth] < b[depth]; };
+    static_assert(std::is_unsigned_v<T>, "only trees of ids into a shared array of positions can be refitted");
+
+    if (elements.empty())
+        return false;
+
+    for (size_t i = 0; i < elements.size(); ++i)
+    {
+        std::array<double, K> const p = position_of(elements[i]);
+        for (size_t axis = 0; axis < K; ++axis)
+            coordinates[axis * elements.size() + i] = static_cast<Real>(p[axis]);
+    }
+
+    fit_bounds({0, elements.size(), 0, 0});
+    if (margin(min_box_edge) <= max_growth * built_margin)
+        return false;
 
-    std::sort(vec.begin() + first, vec.begin() + last + 1, cmp);
+    std::vector<std::array<double, K>> positions(elements.size());
+    for (size_t i = 0; i < elements.size(); ++i)
+        positions[i] = position(i);
 
-    return vec[(first + last) / 2];
+    rebuild(positions);
+    return true;
 }
 
-template<class T, size_t K>
-kdtree<T, K>::node::node(std::vector<T>& vec, size_t first, size_t last, size_t depth)
-        : element{sort_and_take_median(vec, first, last, depth)}
+template<class T, size_t K, typename Real>
+template<typename Visitor>
+void kdtree<T, K, Real>::visit_range(std::array<double, K> const& p, double range, Visitor&& visitor, size_t from) const
 {
-    size_t const median = (first + last) / 2;
+    if (elements.size() <= from)
+        return;
 
-    left = median - first == 0 ? nullptr : new node(vec, first, median - 1, depth + 1);
-    right = last - median == 0 ? nullptr : new node(vec, median + 1, last, depth + 1);
+    std::array<span, max_height> stack;
+    size_t top = 0;
+
+    stack[top++] = {0, elements.size(), 0, 0};
+    while (top > 0)
+    {
+        span const s = stack[--top];
+
+        if (is_leaf(s))
+        {
+            size_t const first = std::max(s.first, from);
+
+            std::array<Real const*, K> block;
+            for (size_t axis = 0; axis < K; ++axis)
+                block[axis] = coordinates.data() + axis * elements.size() + first;
+
+            geom::for_each_within_radius<K>(
+                p, block, s.last - first, range,
+                [this, first, &p, range](size_t i)
+                { return distance(first + i, p) <= range; },
+                [first, &visitor](size_t i)
+                { visitor(first + i); });
+
+            continue;
+        }
+
+        // children are pruned with their boxes along the splitting axis;
+        // subtrees are contiguous ranges: those that end before from are skipped altogether
+        size_t const axis = s.depth % K;
+        if (bounds[s.right().node].lo[axis] <= p[axis] + range)
+            stack[top++] = s.right();
+
+        if (bounds[s.left().node].hi[axis] >= p[axis] - range && s.left().last > from)
+            stack[top++] = s.left();
+    }
 }
 
-template<class T, size_t K>
-kdtree<T, K>::node::~node()
+template<class T, size_t K, typename Real>
+template<typename Visitor>
+void kdtree<T, K, Real>::for_each_in_range(kdpoint<K> const& test, double range, Visitor&& visitor) const
 {
-    delete left;
-    delete right;
+    visit_range(static_cast<std::array<double, K> const&>(test), range, [this, &visitor](size_t i)
+    { visitor(elements[i]); });
 }
 
-template<class T, size_t K>
-void kdtree<T, K>::node::range_search(
-        kdpoint<K> const& test, double range, size_t depth, std::vector<T>& neighbors) const
+template<class T, size_t K, typename Real>
+template<typename Visitor>
+void kdtree<T, K, Real>::for_each_pair_within(double range, Visitor&& visitor) const
 {
-    if (element[depth] < test[depth] - range)
+    // each element only looks for the ones that come after it
+    for (size_t i = 0; i + 1 < elements.size(); ++i)
     {
-        if (right != nullptr)
-            right->range_search(test, range, depth + 1, neighbors);
+        visit_range(position(i), range, [this, i, &visitor](size_t j)
+        { visitor(elements[i], elements[j]); }, i + 1);
     }
+}
+
+template<class T, size_t K, typename Real>
+template<class U, typename Visitor>
+void kdtree<T, K, Real>::for_each_pair_within(kdtree<U, K, Real> const& other, double range, Visitor&& visitor) const
+{ join(other, range, {}, std::forward<Visitor>(visitor)); }
+
+template<class T, size_t K, typename Real>
+template<class U, typename Visitor>
+void kdtree<T, K, Real>::join(
+    kdtree<U, K, Real> const& other, double range, std::array<double, K> const& offset, Visitor&& visitor) const
+{
+    if (elements.empty() || other.elements.empty())
+        return;
 
-    else if (element[depth] > test[depth] + range)
+    // boxes are only a lower bound on distances: the same tolerance of the leaf kernel is kept here
+    double const r2 = range * range * (1 + 4 * std::numeric_limits<double>::epsilon());
+
+    using other_span = typename kdtree<U, K, Real>::span;
+
+    // each step replaces a pair with two pairs one level deeper in one of the trees
+    std::array<std::pair<span, other_span>, 2 * max_height> stack;
+    size_t top = 0;
+
+    stack[top++] = {{0, elements.size(), 0, 0}, {0, other.elements.size(), 0, 0}};
+    while (top > 0)
     {
-        if (left != nullptr)
-            left->range_search(test, range, depth + 1, neighbors);
+        span const a = stack[--top].first;
+        other_span const b = stack[top].second;
+
+        geom::box<K> a_bounds = bounds[a.node];
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            a_bounds.lo[axis] -= offset[axis];
+            a_bounds.hi[axis] -= offset[axis];
+        }
+
+        if (geom::squared_distance(a_bounds, other.bounds[b.node]) > r2)
+            continue;
+
+        bool const a_leaf = is_leaf(a);
+        bool const b_leaf = other.is_leaf(b);
+
+        if (a_leaf && b_leaf)
+        {
+            std::array<Real const*, K> block;
+            for (size_t axis = 0; axis < K; ++axis)
+                block[axis] = other.coordinates.data() + axis * other.elements.size() + b.first;
+
+            for (size_t i = a.first; i < a.last; ++i)
+            {
+                T const& e = elements[i];
+                auto const p = geom::difference<K>(position(i), offset);
+                geom::for_each_within_radius<K>(
+                    p, block, b.last - b.first, range,
+                    [&other, &b, &p, range](size_t j)
+                    { return other.distance(b.first + j, p) <= range; },
+                    [&other, &b, &e, &visitor](size_t j)
+                    { visitor(e, other.elements[b.first + j]); });
+            }
+
+            continue;
+        }
+
+        // the bigger subtree is split first
+        if (b_leaf || (!a_leaf && a.last - a.first >= b.last - b.first))
+        {
+            stack[top++] = {a.right(), b};
+            stack[top++] = {a.left(), b};
+        }
+        else
+        {
+            stack[top++] = {a, b.right()};
+            stack[top++] = {a, b.left()};
+        }
     }
+}
+
+template<class T, size_t K, typename Real>
+template<typename Visitor>
+void kdtree<T, K, Real>::for_each_in_range(
+    kdpoint<K> const& test, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    static_assert(K == 3, "periodic boxes are three-dimensional");
+
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("kdtree: range is too large for the minimum image convention in this box");
+
+    auto const& p = static_cast<std::array<double, K> const&>(test);
+    std::array<double, K> const none{};
 
-    else
+    visit_range(p, range, [this, &visitor, &none](size_t i)
+    { visitor(elements[i], none); });
+
+    // e + shift is within range from p if and only if e is within range from p - shift
+    for (auto const& shift : box.neighbor_shifts())
     {
-        if (left != nullptr)
-            left->range_search(test, range, depth + 1, neighbors);
+        visit_range(geom::difference<K>(p, shift), range, [this, &visitor, &shift](size_t i)
+        { visitor(elements[i], shift); });
+    }
+}
+
+template<class T, size_t K, typename Real>
+template<typename Visitor>
+void kdtree<T, K, Real>::for_each_pair_within(double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    static_assert(K == 3, "periodic boxes are three-dimensional");
 
-        if (right != nullptr)
-            right->range_search(test, range, depth + 1, neighbors);
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("kdtree: range is too large for the minimum image convention in this box");
 
-        if (element.distance(test) <= range)
-            neighbors.push_back(element);
+    std::array<double, K> const none{};
+    for_each_pair_within(range, [&visitor, &none](T const& a, T const& b)
+    { visitor(a, b, none); });
+
+    // a pair across the boundary is seen with either shift or -shift: only one of them is tried
+    for (auto const& shift : box.neighbor_shifts(true))
+    {
+        join(*this, range, shift, [&visitor, &shift](T const& a, T const& b)
+        { visitor(a, b, shift); });
     }
-}
\ No newline at end of file
+}
+
+template<class T, size_t K, typename Real>
+template<class U, typename Visitor>
+void kdtree<T, K, Real>::for_each_pair_within(
+    kdtree<U, K, Real> const& other, double range, geom::lattice const& box, Visitor&& visitor) const
+{
+    static_assert(K == 3, "periodic boxes are three-dimensional");
+
+    if (2 * range > box.min_width())
+        throw std::invalid_argument("kdtree: range is too large for the minimum image convention in this box");
+
+    join(other, range, {}, [&visitor](T const& a, U const& b)
+    { visitor(a, b, std::array<double, K>{}); });
+
+    for (auto const& shift : box.neighbor_shifts())
+    {
+        join(other, range, shift, [&visitor, &shift](T const& a, U const& b)
+        { visitor(a, b, shift); });
+    }
+}
+
+template<class T, size_t K, typename Real>
+template<class Q>
+range_batch kdtree<T, K, Real>::batch_range_search(std::vector<Q> const& queries, double range) const
+{
+    double const r2 = range * range * (1 + 4 * std::numeric_limits<double>::epsilon());
+
+    return batch::run<K>(
+        queries,
+        [this, &queries, range, r2](geom::box<K> const& tile_box, std::vector<size_t> const& tile, auto const& emit)
+        {
+            if (elements.empty())
+                return;
+
+            std::array<span, max_height> stack;
+            size_t top = 0;
+
+            stack[top++] = {0, elements.size(), 0, 0};
+            while (top > 0)
+            {
+                span const s = stack[--top];
+
+                // too far from all the queries of the tile
+                if (geom::squared_distance(bounds[s.node], tile_box) > r2)
+                    continue;
+
+                if (!is_leaf(s))
+                {
+                    stack[top++] = s.right();
+                    stack[top++] = s.left();
+                    continue;
+                }
+
+                std::array<Real const*, K> block;
+                for (size_t axis = 0; axis < K; ++axis)
+                    block[axis] = coordinates.data() + axis * elements.size() + s.first;
+
+                for (auto q : tile)
+                {
+                    auto const& p = static_cast<std::array<double, K> const&>(queries[q]);
+                    geom::for_each_within_radius<K>(
+                        p, block, s.last - s.first, range,
+                        [this, &s, &p, range](size_t i)
+                        { return distance(s.first + i, p) <= range; },
+                        [&s, &emit, q](size_t i)
+                        { emit(q, s.first + i); });
+                }
+            }
+        });
+}
+
+template<class T, size_t K, typename Real>
+void kdtree<T, K, Real>::range_search(kdpoint<K> const& test, double range, std::vector<size_t>& neighbors) const
+{
+    neighbors.clear();
+    visit_range(static_cast<std::array<double, K> const&>(test), range, [&neighbors](size_t i)
+    { neighbors.push_back(i); });
+}
+
+template<class T, size_t K, typename Real>
+std::vector<size_t> kdtree<T, K, Real>::nearest(kdpoint<K> const& test, size_t k, double range) const
+{
+    if (elements.empty() || k == 0)
+        return {};
+
+    // max-heap of (squared distance, position): the root is the farthest of the best k so far
+    std::vector<std::pair<double, size_t>> heap;
+    heap.reserve(std::min(k, elements.size()) + 1);
+
+    auto const& p = static_cast<std::array<double, K> const&>(test);
+    geom::box<K> const point{p, p};
+
+    // same tolerance of the range search kernel around range
+    double const r2_low = range * range * (1 - 4 * std::numeric_limits<double>::epsilon());
+    double const r2_high = range * range * (1 + 4 * std::numeric_limits<double>::epsilon());
+
+    auto const bound = [&heap, k, r2_high]
+    { return heap.size() < k ? r2_high : heap.front().first; };
+
+    std::array<span, max_height> stack;
+    size_t top = 0;
+
+    stack[top++] = {0, elements.size(), 0, 0};
+    while (top > 0)
+    {
+        span const s = stack[--top];
+
+        // the bound only shrinks: subtrees are checked again when they are popped
+        if (geom::squared_distance(bounds[s.node], point) > bound())
+            continue;
+
+        if (is_leaf(s))
+        {
+            std::array<Real const*, K> block;
+            for (size_t axis = 0; axis < K; ++axis)
+                block[axis] = coordinates.data() + axis * elements.size() + s.first;
+
+            geom::for_each_within_squared_radius<K>(
+                p, block, s.last - s.first, bound(),
+                [this, &s, &p, &heap, &bound, k, range, r2_low](size_t i, double d2)
+                {
+                    if (d2 > bound() || (heap.size() == k && d2 == heap.front().first))
+                        return;
+
+                    if (d2 > r2_low && distance(s.first + i, p) > range)
+                        return;
+
+                    heap.emplace_back(d2, s.first + i);
+                    std::push_heap(heap.begin(), heap.end());
+
+                    if (heap.size() > k)
+                    {
+                        std::pop_heap(heap.begin(), heap.end());
+                        heap.pop_back();
+                    }
+                });
+
+            continue;
+        }
+
+        // the nearer subtree is visited first, so that the bound shrinks as soon as possible
+        if (geom::squared_distance(bounds[s.left().node], point) < geom::squared_distance(bounds[s.right().node], point))
+        {
+            stack[top++] = s.right();
+            stack[top++] = s.left();
+        }
+        else
+        {
+            stack[top++] = s.left();
+            stack[top++] = s.right();
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+
+    std::vector<size_t> positions;
+    positions.reserve(heap.size());
+    for (auto const& candidate : heap)
+        positions.push_back(candidate.second);
+
+    return positions;
+}
+
+template<class T, size_t K, typename Real>
+std::vector<T> kdtree<T, K, Real>::knn(kdpoint<K> const& test, size_t k, double range) const
+{
+    std::vector<T> neighbors;
+    for (auto i : nearest(test, k, range))
+        neighbors.push_back(elements[i]);
+
+    return neighbors;
+}
+
+template<class T, size_t K, typename Real>
+std::vector<T> kdtree<T, K, Real>::knn(kdpoint<K> const& test, size_t k) const
+{ return knn(test, k, std::numeric_limits<double>::infinity()); }
+
+template<class T, size_t K, typename Real>
+std::vector<T> kdtree<T, K, Real>::range_search(kdpoint<K> const& test, double range) const
+{
+    std::vector<T> neighbors;
+    for_each_in_range(test, range, [&neighbors](T const& element)
+    { neighbors.push_back(element); });
+
+    return neighbors;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "kdpoint.h"
+
+/**
+ * Results of a batch of range queries, grouped per query (compressed sparse rows).
+ * <br/>
+ * <br/>
+ * The neighbors of the q-th query are neighbors[first[q]], ..., neighbors[first[q + 1] - 1],
+ * as positions in the index that was searched (see operator[] of the index).
+ */
+struct range_batch
+{
+    std::vector<size_t> first;
+    std::vector<size_t> neighbors;
+
+    // number of queries
+    [[nodiscard]]
+    size_t size() const
+    { return first.empty() ? 0 : first.size() - 1; }
+
+    // number of neighbors of the q-th query
+    [[nodiscard]]
+    size_t count(size_t q) const
+    { return first[q + 1] - first[q]; }
+};
+
+namespace batch
+{
+// queries are run this many at a time, sharing one traversal of the index
+constexpr size_t tile_size = 32;
+
+// permutation of the points that sorts them along the Z-order (Morton) curve of their bounding box
+template<size_t K, class P>
+std::vector<size_t> morton_order(std::vector<P> const& points)
+{
+    constexpr unsigned bits = 63 / K;
+
+    std::vector<size_t> order(points.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    if (points.empty())
+        return order;
+
+    geom::box<K> bounds{
+        static_cast<std::array<double, K> const&>(points.front()),
+        static_cast<std::array<double, K> const&>(points.front())};
+    for (auto const& p : points)
+        bounds = geom::merge(bounds, {static_cast<std::array<double, K> const&>(p), static_cast<std::array<double, K> const&>(p)});
+
+    // coordinates are quantized to the given bits, then interleaved from the most significant one
+    std::vector<uint64_t> keys(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        auto const& p = static_cast<std::array<double, K> const&>(points[i]);
+
+        std::array<uint64_t, K> cell{};
+        for (size_t axis = 0; axis < K; ++axis)
+        {
+            double const extent = bounds.hi[axis] - bounds.lo[axis];
+            cell[axis] = extent > 0
+                         ? static_cast<uint64_t>((p[axis] - bounds.lo[axis]) / extent * ((uint64_t{1} << bits) - 1))
+                         : 0;
+        }
+
+        uint64_t key = 0;
+        for (unsigned b = bits; b-- > 0;)
+            for (size_t axis = 0; axis < K; ++axis)
+                key = (key << 1) | ((cell[axis] >> b) & 1);
+
+        keys[i] = key;
+    }
+
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b)
+    { return keys[a] < keys[b]; });
+
+    return order;
+}
+
+/**
+ * Runs a batch of range queries in tiles of nearby queries.
+ * <br/>
+ * Queries are sorted in Z-order and cut into tiles of tile_size; scan(tile_box, tile, emit) is called once per tile,
+ * with the bounding box of its queries and their positions in the queries vector, and it must call emit(q, i)
+ * for each neighbor i of each query q of the tile.
+ */
+template<size_t K, class Q, typename Scan>
+range_batch run(std::vector<Q> const& queries, Scan&& scan)
+{
+    auto const order = morton_order<K>(queries);
+
+    // (query, neighbor) pairs, in tile order
+    std::vector<std::pair<size_t, size_t>> hits;
+    auto const emit = [&hits](size_t q, size_t i)
+    { hits.emplace_back(q, i); };
+
+    std::vector<size_t> tile;
+    tile.reserve(tile_size);
+    for (size_t t = 0; t < order.size(); t += tile_size)
+    {
+        tile.assign(order.begin() + t, order.begin() + std::min(t + tile_size, order.size()));
+
+        auto const& p = static_cast<std::array<double, K> const&>(queries[tile.front()]);
+        geom::box<K> tile_box{p, p};
+        for (auto q : tile)
+        {
+            auto const& r = static_cast<std::array<double, K> const&>(queries[q]);
+            tile_box = geom::merge(tile_box, {r, r});
+        }
+
+        scan(tile_box, tile, emit);
+    }
+
+    // counting sort by query
+    range_batch results;
+    results.first.assign(queries.size() + 1, 0);
+    for (auto const& [q, i] : hits)
+        ++results.first[q + 1];
+
+    for (size_t q = 1; q < results.first.size(); ++q)
+        results.first[q] += results.first[q - 1];
+
+    std::vector<size_t> next(results.first.begin(), results.first.end() - 1);
+    results.neighbors.resize(hits.size());
+    for (auto const& [q, i] : hits)
+        results.neighbors[next[q]++] = i;
+
+    return results;
+}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+#include "geometry.h"
+
+/**
+ * Cost model of the pair searches (joins and self-joins) over the spatial indices, to choose the cheapest one.
+ * <br/>
+ * <br/>
+ * An estimate is the time, in nanoseconds, of building the indices of both sides and enumerating the pairs within
+ * range, assuming that the points are uniformly spread over their bounding box.
+ * Its constants are fitted on RINmaker_bench_spatial (protein-like clouds, double precision, one core):
+ * they are meant to rank the algorithms, not to predict their actual times.
+ */
+namespace search_cost
+{
+// the same order of the alternatives of spatial_index in rin::maker
+enum class algorithm
+{
+    KDTREE, CELL_GRID, BRUTE_FORCE
+};
+
+inline char const* name(algorithm a)
+{
+    switch (a)
+    {
+    case algorithm::KDTREE:
+        return "kdtree";
+    case algorithm::CELL_GRID:
+        return "cell grid";
+    case algorithm::BRUTE_FORCE:
+    default:
+        return "brute force";
+    }
+}
+
+// the points on one side of a search
+struct side
+{
+    size_t size = 0;
+    geom::box<3> bounds{};
+
+    // the points positions[ids[i]]
+    template<typename Id>
+    static side of(std::vector<std::array<double, 3>> const& positions, std::vector<Id> const& ids)
+    {
+        side s;
+        s.size = ids.size();
+        if (ids.empty())
+            return s;
+
+        s.bounds.lo = s.bounds.hi = positions[ids.front()];
+        for (auto id : ids)
+            s.bounds = geom::merge<3>(s.bounds, {positions[id], positions[id]});
+
+        return s;
+    }
+};
+
+struct estimate
+{
+    std::array<double, 3> times{};
+
+    [[nodiscard]]
+    double of(algorithm a) const
+    { return times[static_cast<size_t>(a)]; }
+
+    // ties go to brute force, which has nothing to build
+    [[nodiscard]]
+    algorithm best() const
+    {
+        auto best = algorithm::BRUTE_FORCE;
+        for (auto a : {algorithm::KDTREE, algorithm::CELL_GRID})
+            if (of(a) < of(best))
+                best = a;
+
+        return best;
+    }
+};
+
+namespace detail
+{
+// brute force: copy of the coordinates, per point; distance test, per pair
+constexpr double brute_force_copy = 9;
+constexpr double brute_force_test = 3;
+
+// kdtree: build, per point and level; descent, per query and level; test, per point in the (2*range)-edged cube
+constexpr double kdtree_build = 20;
+constexpr double kdtree_descent = 44;
+constexpr double kdtree_test = 30;
+
+// cell grid: build, per point and per cell; lookup of the 3x3x3 block, per query; test, per point in the block
+constexpr double cell_grid_build = 30;
+constexpr double cell_grid_cell = 5;
+constexpr double cell_grid_lookup = 266;
+constexpr double cell_grid_test = 3.8;
+
+// shorter ranges are estimated as this one, so that volumes are never zero
+constexpr double min_range = 0.1;
+
+// volume of the bounding box, as if it were at least range thick along each axis
+inline double volume(side const& s, double range)
+{
+    double v = 1;
+    for (size_t axis = 0; axis < 3; ++axis)
+        v *= std::max(s.bounds.hi[axis] - s.bounds.lo[axis], range);
+
+    return v;
+}
+
+// points of s expected in a region of the given volume
+inline double expected_in(side const& s, double range, double region)
+{ return std::min(static_cast<double>(s.size), s.size / volume(s, range) * region); }
+
+inline double levels(side const& s)
+{ return std::log2(static_cast<double>(s.size) + 1); }
+
+// cells of the grid of s, with the same cap of cell_grid (at most 8 per point, plus 64)
+inline double cells(side const& s, double range)
+{ return std::min(volume(s, range) / (range * range * range), 8.0 * s.size + 64); }
+
+inline double cell_edge(side const& s, double range)
+{ return std::cbrt(volume(s, range) / cells(s, range)); }
+
+inline double kdtree_build_time(side const& s)
+{ return kdtree_build * s.size * levels(s); }
+
+inline double cell_grid_build_time(side const& s, double range)
+{ return cell_grid_build * s.size + cell_grid_cell * cells(s, range); }
+
+// per query into s
+inline double kdtree_query_time(side const& s, double range, double share)
+{ return kdtree_descent * levels(s) + share * kdtree_test * expected_in(s, range, std::pow(2 * range, 3)); }
+
+inline double cell_grid_query_time(side const& s, double range, double share)
+{ return cell_grid_lookup + share * cell_grid_test * expected_in(s, range, std::pow(3 * cell_edge(s, range), 3)); }
+}
+
+// every point of first is searched for in second
+inline estimate join(side const& first, side const& second, double range)
+{
+    using namespace detail;
+    range = std::max(range, min_range);
+
+    double const n1 = static_cast<double>(first.size);
+    double const n2 = static_cast<double>(second.size);
+
+    estimate e;
+    e.times[static_cast<size_t>(algorithm::KDTREE)] =
+        kdtree_build_time(first) + kdtree_build_time(second) + n1 * kdtree_query_time(second, range, 1);
+    e.times[static_cast<size_t>(algorithm::CELL_GRID)] =
+        cell_grid_build_time(first, range) + cell_grid_build_time(second, range) +
+        n1 * cell_grid_query_time(second, range, 1);
+    e.times[static_cast<size_t>(algorithm::BRUTE_FORCE)] = brute_force_copy * (n1 + n2) + brute_force_test * n1 * n2;
+
+    return e;
+}
+
+// each point is only tested against the ones after it, i.e. about half of its candidates
+inline estimate self_join(side const& s, double range)
+{
+    using namespace detail;
+    range = std::max(range, min_range);
+
+    double const n = static_cast<double>(s.size);
+
+    estimate e;
+    e.times[static_cast<size_t>(algorithm::KDTREE)] = kdtree_build_time(s) + n * kdtree_query_time(s, range, 0.5);
+    e.times[static_cast<size_t>(algorithm::CELL_GRID)] =
+        cell_grid_build_time(s, range) + n * cell_grid_query_time(s, range, 0.5);
+    e.times[static_cast<size_t>(algorithm::BRUTE_FORCE)] =
+        brute_force_copy * n + brute_force_test * n * std::max(n - 1, 0.0) / 2;
+
+    return e;
+}
+}
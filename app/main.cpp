@@ -7,6 +7,12 @@
 
 #pragma warning(pop)
 
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "cli_utils.h"
 
 #include "rin_maker.h"
@@ -65,14 +71,63 @@ int main(int argc, const char* argv[])
         else
             lm::main()->info("hydrogen fixing not performed.");
 
+        // With periodic boundary conditions, the searches wrap the residues into the unit cell (see rin::maker):
+        // the coordinates of the input are left as they are.
+        if (parsed_args.periodic() && !protein.cell.is_crystal())
+            lm::main()->warn("no crystal unit cell in the input: periodic boundary conditions are ignored.");
+
         lm::main()->info("n. of models found: {}", protein.models.size());
 
-        auto const process = [&parsed_args](
+        // Candidate pairs are only kept from one model to the next with a skin.
+        std::optional<rin::neighbor_lists> maybe_lists{std::nullopt};
+        if (parsed_args.verlet_skin() > 0)
+            maybe_lists.emplace(parsed_args.verlet_skin());
+
+        auto const process = [&parsed_args, &maybe_lists](
             gemmi::Model const& model,
             gemmi::Structure const& protein,
             std::filesystem::path const& filename)
         {
-            auto graph = rin::maker{model, protein, parsed_args}(parsed_args);
+            rin::maker const maker{model, protein, parsed_args};
+            auto graph = maybe_lists.has_value() ? maker(parsed_args, *maybe_lists) : maker(parsed_args);
+
+            // The network is computed again with single precision indices, and only compared with this one.
+            if (parsed_args.precision() == rin::parameters::precision_t::VALIDATE)
+            {
+                auto const single_graph = rin::maker{model, protein, parsed_args, true}(parsed_args);
+
+                auto const edge_keys = [](rin::graph const& g)
+                {
+                    std::set<std::string> keys;
+                    for (auto const& e: g.get_edges())
+                        keys.insert(
+                            e.get_interaction() + " " + e.get_source_id() + " " + e.get_source_atom() + " " +
+                            e.get_target_id() + " " + e.get_target_atom());
+                    return keys;
+                };
+
+                auto const double_keys = edge_keys(graph);
+                auto const single_keys = edge_keys(single_graph);
+
+                std::vector<std::string> only_double, only_single;
+                std::set_difference(
+                    double_keys.begin(), double_keys.end(), single_keys.begin(), single_keys.end(),
+                    std::back_inserter(only_double));
+                std::set_difference(
+                    single_keys.begin(), single_keys.end(), double_keys.begin(), double_keys.end(),
+                    std::back_inserter(only_single));
+
+                lm::main()->info(
+                    "precision validation: {} edges in double precision, {} only in double, {} only in single",
+                    double_keys.size(), only_double.size(), only_single.size());
+
+                // a few of them are enough to tell the pairs at the cutoffs from an actual bug
+                size_t constexpr shown = 10;
+                for (size_t i = 0; i < std::min(shown, only_double.size()); ++i)
+                    lm::main()->warn("==> only in double: {}", only_double[i]);
+                for (size_t i = 0; i < std::min(shown, only_single.size()); ++i)
+                    lm::main()->warn("==> only in single: {}", only_single[i]);
+            }
 
             if (parsed_args.csv_out())
             {
@@ -109,6 +109,41 @@ optional<rin::parameters> read_args(int argc, char const* argv[])
                 CLI::detail::generate_map(CLI::detail::smart_deref(ill_map), true)))
         ->default_val("sres");
 
+    auto spatial_index = rin::parameters::spatial_index_t::AUTO;
+    std::map<std::string, rin::parameters::spatial_index_t> sidx_map{
+        {"kdtree", rin::parameters::spatial_index_t::KDTREE},
+        {"grid", rin::parameters::spatial_index_t::CELL_GRID},
+        {"brute", rin::parameters::spatial_index_t::BRUTE_FORCE},
+        {"auto", rin::parameters::spatial_index_t::AUTO}};
+
+    app.add_option(
+            "--spatial-index", spatial_index, "Data structure used for neighbor search")
+        ->transform(
+            CLI::CheckedTransformer(sidx_map, CLI::ignore_case).description(
+                CLI::detail::generate_map(CLI::detail::smart_deref(sidx_map), true)))
+        ->default_val("auto");
+
+    bool periodic{false};
+    app.add_flag("--pbc", periodic, "Periodic boundary conditions from the unit cell (CRYST1) of the input");
+
+    double verlet_skin;
+    app.add_option("--verlet-skin", verlet_skin, "Skin distance of the neighbor lists reused across models with -d (0 disables them)")
+        ->default_val(cfg::params::verlet_skin)
+        ->check(CLI::NonNegativeNumber);
+
+    auto precision = rin::parameters::precision_t::DOUBLE;
+    std::map<std::string, rin::parameters::precision_t> prec_map{
+        {"double", rin::parameters::precision_t::DOUBLE},
+        {"single", rin::parameters::precision_t::SINGLE},
+        {"validate", rin::parameters::precision_t::VALIDATE}};
+
+    app.add_option(
+            "--precision", precision, "Precision of the coordinates in neighbor search (validate: compare the two)")
+        ->transform(
+            CLI::CheckedTransformer(prec_map, CLI::ignore_case).description(
+                CLI::detail::generate_map(CLI::detail::smart_deref(prec_map), true)))
+        ->default_val("double");
+
     // rin subcommand
     auto rin_app = app.add_subcommand(
             "rin", "Compute the residue interaction network");
@@ -238,6 +273,10 @@ optional<rin::parameters> read_args(int argc, char const* argv[])
             .set_no_hydrogen(no_hydrogen)
 
             .set_illformed_policy(illformed)
+            .set_spatial_index(spatial_index)
+            .set_periodic(periodic)
+            .set_verlet_skin(verlet_skin)
+            .set_precision(precision)
 
             .set_input(pdb_path)
             .set_output(out_path, output_as_directory)
@@ -40,6 +40,7 @@ const double surface_dist_vdw = 0.5;
 const double query_dist_ionic = 4.0;
 const double query_dist_pipi = 6.5;
 const double query_dist_pica = 5.0;
+const double query_dist_hydrophobic = 7.5;
 
 const double query_dist_alpha = 6.0;
 const double query_dist_beta = 6.0;
@@ -51,6 +52,10 @@ const double max_limit = 20.0;
 const double max_vdw_radius = 1.90;
 const double max_pipi_atom_atom_distance = 4.5;
 
+const size_t parallel_build_threshold = size_t{1} << 16;
+
+const double verlet_skin = 0;
+
 const double pipistack_normal_normal_angle_range = 30;
 const double pipistack_normal_centre_angle_range = 60;
 
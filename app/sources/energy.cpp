@@ -255,4 +255,12 @@ double* get_vdw_opsl_values(string const& residue, string const& atom, string co
         throw std::invalid_argument("get_vdw_opsl_values: residue " + residue + ", atom " + atom + ", element " + element + " unsupported");
 }
 
+double* get_vdw_opsl_values(int index)
+{
+    if (index > 0 && static_cast<size_t>(index) < sizeof(opslVdw) / sizeof(opslVdw[0]))
+        return opslVdw[index];
+    else
+        throw std::invalid_argument("get_vdw_opsl_values: index " + std::to_string(index) + " unsupported");
+}
+
 #pragma endregion 
\ No newline at end of file
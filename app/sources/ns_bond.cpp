@@ -160,10 +160,10 @@ generic_bond::generic_bond(atom const& a, atom const& b, double distance) :
     _target(a < b ? b : a)
 {}
 
-chemical_entity::aminoacid generic_bond::get_source() const
+chemical_entity::aminoacid const& generic_bond::get_source() const
 { return _source.get_residue(); }
 
-chemical_entity::aminoacid generic_bond::get_target() const
+chemical_entity::aminoacid const& generic_bond::get_target() const
 { return _target.get_residue(); }
 
 string generic_bond::get_interaction() const
@@ -172,25 +172,25 @@ string generic_bond::get_interaction() const
 //Returns a pair of Sigmaij Epsilonij
 pair<double, double> hydrogen::getSigmaEpsilon(atom const& donor, atom const& acceptor)
 {
-    std::function<bool(string const&, int, string const&, int)> compare =
-        [&](string const& donor_element, int donor_charge, string const& acceptor_element, int acceptor_charge)
-        {
-            return donor.get_symbol() == donor_element
-                && donor.get_charge() == donor_charge
-                && acceptor.get_symbol() == acceptor_element
-                && acceptor.get_charge() == acceptor_charge;
-        };
+    using gemmi::El;
+    auto const compare = [&](El donor_element, int donor_charge, El acceptor_element, int acceptor_charge)
+    {
+        return donor.get_element() == donor_element
+            && donor.get_charge() == donor_charge
+            && acceptor.get_element() == acceptor_element
+            && acceptor.get_charge() == acceptor_charge;
+    };
 
-    if (compare("N", 0, "N", 0)) return std::make_pair(1.99, -3.00);
-    if (compare("N", 0, "O", 0)) return std::make_pair(1.89, -3.50);
-    if (compare("O", 0, "N", 0)) return std::make_pair(1.89, -4.00);
-    if (compare("O", 0, "O", 0)) return std::make_pair(1.79, -4.25);
-    if (compare("N", 1, "N", 0)) return std::make_pair(1.99, -4.50);
-    if (compare("N", 1, "O", 0)) return std::make_pair(1.89, -5.25);
+    if (compare(El::N, 0, El::N, 0)) return std::make_pair(1.99, -3.00);
+    if (compare(El::N, 0, El::O, 0)) return std::make_pair(1.89, -3.50);
+    if (compare(El::O, 0, El::N, 0)) return std::make_pair(1.89, -4.00);
+    if (compare(El::O, 0, El::O, 0)) return std::make_pair(1.79, -4.25);
+    if (compare(El::N, 1, El::N, 0)) return std::make_pair(1.99, -4.50);
+    if (compare(El::N, 1, El::O, 0)) return std::make_pair(1.89, -5.25);
 
-    if (compare("N", 0, "O", -1)) return std::make_pair(1.89, -5.25);
-    if (compare("N", 1, "O", -1)) return std::make_pair(1.89, -7.00);
-    if (compare("O", 0, "O", -1)) return std::make_pair(1.79, -6.375);
+    if (compare(El::N, 0, El::O, -1)) return std::make_pair(1.89, -5.25);
+    if (compare(El::N, 1, El::O, -1)) return std::make_pair(1.89, -7.00);
+    if (compare(El::O, 0, El::O, -1)) return std::make_pair(1.79, -6.375);
 
     return std::make_pair(1.79, -4.25); //Default value (is valid for all MC_MC bond)
 
@@ -337,8 +337,8 @@ string ss::get_id() const
 
 double vdw::energy(atom const& source_atom, atom const& target_atom)
 {
-    double* source_opts = get_vdw_opsl_values(source_atom.get_residue().get_name(), source_atom.get_name(), source_atom.get_symbol());
-    double* target_opts = get_vdw_opsl_values(target_atom.get_residue().get_name(), target_atom.get_name(), target_atom.get_symbol());
+    double* source_opts = get_vdw_opsl_values(source_atom.get_vdw_opsl_index());
+    double* target_opts = get_vdw_opsl_values(target_atom.get_vdw_opsl_index());
 
     double source_sigma = source_opts[1];
     double target_sigma = target_opts[1];
@@ -370,7 +370,7 @@ string vdw::get_interaction() const
     return "VDW:" + sourceChain + "_" + targetChain;
 }
 
-std::shared_ptr<hydrogen const> hydrogen::test(parameters const& params, atom const& acceptor, atom const& donor)
+std::shared_ptr<hydrogen const> hydrogen::test(parameters const& params, atom const& acceptor, atom const& donor, allocator const& alloc)
 {
     if (acceptor.get_residue().satisfies_minimum_sequence_separation(donor.get_residue()))
     {
@@ -381,14 +381,15 @@ std::shared_ptr<hydrogen const> hydrogen::test(parameters const& params, atom co
             {
                 auto const da = (array<double, 3>) (acceptor - donor);
                 auto const dh = (array<double, 3>) (h - donor);
-                double angle_adh = geom::angle<3>(da, dh);
 
-                auto const ha = (array<double, 3>) (acceptor - h);
-                auto const hd = (array<double, 3>) (donor - h);
-                double angle_ahd = geom::angle<3>(ha, hd);
-
-                if (angle_adh <= params.hbond_angle()) // 63
-                    return std::make_shared<hydrogen const>(acceptor, donor, h, angle_ahd);
+                // angle_adh <= 63
+                if (geom::angle_within<3>(da, dh, params.hbond_angle_limit()))
+                {
+                    // only the angle that goes on the edge is actually computed
+                    auto const ha = (array<double, 3>) (acceptor - h);
+                    auto const hd = (array<double, 3>) (donor - h);
+                    return std::allocate_shared<hydrogen>(alloc, acceptor, donor, h, geom::angle<3>(ha, hd));
+                }
             }
         }
     }
@@ -405,10 +406,10 @@ string hydrogen::get_id() const
         get_target_atom().get_name();
 }
 
-std::shared_ptr<vdw const> vdw::test(parameters const& params, atom const& a, atom const& b)
+std::shared_ptr<vdw const> vdw::test(parameters const& params, atom const& a, atom const& b, allocator const& alloc)
 {
     if (a.get_residue().satisfies_minimum_sequence_separation(b.get_residue()) && a.distance(b) - (a.get_vdw_radius() + b.get_vdw_radius()) <= params.surface_dist_vdw())
-        return std::make_shared<vdw const>(a, b);
+        return std::allocate_shared<vdw>(alloc, a, b);
     return nullptr;
 }
 
@@ -433,10 +434,10 @@ string vdw::get_id() const
 }
 
 
-std::shared_ptr<ionic const> ionic::test(parameters const& params, ionic_group const& negative, ionic_group const& positive)
+std::shared_ptr<ionic const> ionic::test(parameters const& params, ionic_group const& negative, ionic_group const& positive, allocator const& alloc)
 {
     if (negative.get_residue().satisfies_minimum_sequence_separation(positive.get_residue()) && negative.get_charge() == -positive.get_charge())
-        return std::make_shared<ionic const>(negative, positive);
+        return std::allocate_shared<ionic>(alloc, negative, positive);
 
     return nullptr;
 }
@@ -450,13 +451,18 @@ string ionic::get_id() const
         get_target_negative().get_name();
 }
 
-std::shared_ptr<pication const> pication::test(parameters const& params, atom const& cation, ring const& ring)
+std::shared_ptr<pication const> pication::test(parameters const& params, atom const& cation, ring const& ring, allocator const& alloc)
 {
     if (ring.get_residue().satisfies_minimum_sequence_separation(cation.get_residue(), params.sequence_separation()))
     {
-        double theta = 90 - geom::d_angle<3>(ring.get_normal(), (array<double, 3>) (ring - cation));
-        if (theta >= params.pication_angle()) // 45
-            return std::make_shared<pication const>(ring, cation, theta);
+        auto const ring_cation = (array<double, 3>) (ring - cation);
+
+        // theta >= 45
+        if (geom::d_angle_within<3>(ring.get_normal(), ring_cation, params.pication_limit()))
+        {
+            double const theta = 90 - geom::d_angle<3>(ring.get_normal(), ring_cation);
+            return std::allocate_shared<pication>(alloc, ring, cation, theta);
+        }
     }
 
     return nullptr;
@@ -471,19 +477,18 @@ string pication::get_id() const
         get_target_cation().get_name();
 }
 
-std::shared_ptr<pipistack const> pipistack::test(parameters const& params, ring const& a, ring const& b)
+std::shared_ptr<pipistack const> pipistack::test(parameters const& params, ring const& a, ring const& b, allocator const& alloc)
 {
-    double nc1 = a.get_angle_between_normal_and_centers_joining(b);
-    double nc2 = b.get_angle_between_normal_and_centers_joining(a);
-    double nn = a.get_angle_between_normals(b);
-    double mn = a.get_distance_between_closest_atoms(b);
+    // b - a would do as well for the normal of b: the angles between directions do not depend on the sign of vectors
+    auto const centres_joining = (array<double, 3>) (a - b);
 
+    // cheapest tests first: the angle between the normals is only computed for the bonds
     if (a.get_residue().satisfies_minimum_sequence_separation(b.get_residue()) &&
-        (0 <= nn && nn <= params.pipistack_normal_normal_angle_range()) &&
-        ((0 <= nc1 && nc1 <= params.pipistack_normal_centre_angle_range()) ||
-         (0 <= nc2 && nc2 <= params.pipistack_normal_centre_angle_range())) &&
-        mn <= cfg::params::max_pipi_atom_atom_distance)
-    { return std::make_shared<pipistack const>(a, b, nn); }
+        geom::d_angle_within<3>(a.get_normal(), b.get_normal(), params.pipistack_normal_normal_limit()) &&
+        (geom::d_angle_within<3>(a.get_normal(), centres_joining, params.pipistack_normal_centre_limit()) ||
+         geom::d_angle_within<3>(b.get_normal(), centres_joining, params.pipistack_normal_centre_limit())) &&
+        a.get_distance_between_closest_atoms(b) <= cfg::params::max_pipi_atom_atom_distance)
+    { return std::allocate_shared<pipistack>(alloc, a, b, a.get_angle_between_normals(b)); }
 
     return nullptr;
 }
@@ -553,16 +558,16 @@ string ionic::get_id_simple() const
 string ss::get_id_simple() const
 { return "SS:" + get_source_id() + ":" + get_target_id(); }
 
-std::shared_ptr<hydrophobic const> hydrophobic::test(rin::parameters const&, chemical_entity::atom const& a, chemical_entity::atom const& b)
+std::shared_ptr<hydrophobic const> hydrophobic::test(rin::parameters const&, chemical_entity::atom const& a, chemical_entity::atom const& b, allocator const& alloc)
 {
     static set<string> const names = {"ILE", "LEU", "VAL", "MET", "PHE", "ALA", "TRP", "CYS", "GLY"};
-    auto res_a = a.get_residue();
-    auto res_b = b.get_residue();
+    auto const& res_a = a.get_residue();
+    auto const& res_b = b.get_residue();
 
     if (res_a.satisfies_minimum_sequence_separation(res_b)
         && names.find(res_a.get_name()) != names.end()
         && names.find(res_b.get_name()) != names.end())
-    { return std::make_shared<hydrophobic>(a, b); }
+    { return std::allocate_shared<hydrophobic>(alloc, a, b); }
 
     return nullptr;
 }
@@ -613,10 +618,10 @@ std::string hydrophobic::get_interaction() const
     return "HYDROPHOBIC";
 }
 
-std::shared_ptr<contact const> contact::test(parameters const& params, atom const& a, atom const& b)
+std::shared_ptr<contact const> contact::test(parameters const& params, atom const& a, atom const& b, allocator const& alloc)
 {
     if (a.get_residue().satisfies_minimum_sequence_separation(b.get_residue()))
-        return std::make_shared<contact const>(a, b);
+        return std::allocate_shared<contact>(alloc, a, b);
     return nullptr;
 }
 
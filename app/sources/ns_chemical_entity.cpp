@@ -1,5 +1,7 @@
 #include "ns_chemical_entity.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 #include <functional>
 
@@ -10,7 +12,7 @@
 
 using std::vector, std::array, std::string, std::unique_ptr, std::make_unique, std::to_string, std::invalid_argument;
 
-using chemical_entity::aminoacid, chemical_entity::atom, chemical_entity::ring, chemical_entity::ionic_group;
+using chemical_entity::aminoacid, chemical_entity::atom, chemical_entity::atom_table, chemical_entity::ring, chemical_entity::ionic_group;
 
 string join_strings(std::vector<std::string> const& values, std::string_view delimiter)
 {
@@ -71,8 +73,11 @@ string const& aminoacid::get_id() const
 int aminoacid::get_sequence_number() const
 { return _pimpl->sequence_number; }
 
+uint32_t aminoacid::get_index() const
+{ return _pimpl->index; }
+
 bool aminoacid::operator==(aminoacid const& rhs) const
-{ return _pimpl->id == rhs._pimpl->id; }
+{ return _pimpl->table == rhs._pimpl->table && _pimpl->index == rhs._pimpl->index; }
 
 bool aminoacid::operator!=(aminoacid const& rhs) const
 { return !(*this == rhs); }
@@ -82,7 +87,7 @@ bool aminoacid::satisfies_minimum_sequence_separation(aminoacid const& other, in
     if (*this == other)
         return false;
 
-    return get_chain_id() != other.get_chain_id() || abs(get_sequence_number() - other.get_sequence_number()) >= minimum_separation;
+    return _pimpl->chain_index != other._pimpl->chain_index || abs(get_sequence_number() - other.get_sequence_number()) >= minimum_separation;
 }
 
 aminoacid::operator rin::node() const
@@ -212,18 +217,29 @@ void try_assignment(
 }
 
 chemical_entity::aminoacid::aminoacid(
+    residue_table const& table,
+    atom_table& atoms,
     gemmi::Residue const& residue,
     gemmi::Chain const& chain,
     gemmi::Model const& model,
     gemmi::Structure const& protein,
     rin::parameters const& params) :
-    _pimpl(std::make_shared<impl>())
+    _pimpl(std::allocate_shared<impl>(std::pmr::polymorphic_allocator<impl>(atoms.resource())))
 {
     // basic info
     _pimpl->name = residue.name;
     _pimpl->sequence_number = residue.seqid.num.value;
     _pimpl->chain_id = chain.name;
 
+    // components refer to this by position, so that nothing on their side needs to be reference counted
+    _pimpl->table = &table;
+    _pimpl->index = static_cast<uint32_t>(table.size());
+    _pimpl->resource = atoms.resource();
+
+    auto const same_name = std::find_if(model.chains.begin(), model.chains.end(), [&chain](gemmi::Chain const& c)
+    { return c.name == chain.name; });
+    _pimpl->chain_index = static_cast<uint32_t>(same_name - model.chains.begin());
+
     _pimpl->id = _pimpl->chain_id + ":" + to_string(_pimpl->sequence_number) + ":_:" + _pimpl->name;
 
     _pimpl->protein_name = protein.name;
@@ -275,7 +291,7 @@ chemical_entity::aminoacid::aminoacid(
 
     for (auto const& record: residue.atoms)
     {
-        auto atom = chemical_entity::atom{record, *this};
+        auto atom = chemical_entity::atom{atoms, record, *this};
         _pimpl->atoms.push_back(atom);
 
         if (atom.get_name() == "CA")
@@ -362,13 +378,15 @@ chemical_entity::aminoacid::aminoacid(
 }
 
 aminoacid::aminoacid(
+    residue_table const& table,
+    atom_table& atoms,
     gemmi::Residue const& residue,
     gemmi::Chain const& chain,
     gemmi::Model const& model,
     gemmi::Structure const& protein,
     rin::parameters const& params,
     std::optional<std::variant<gemmi::Helix, gemmi::Sheet::Strand>> const& secondary_structure) :
-    aminoacid(residue, chain, model, protein, params)
+    aminoacid(table, atoms, residue, chain, model, protein, params)
 {
     if (!secondary_structure.has_value())
         _pimpl->secondary_structure_name = "LOOP";
@@ -378,210 +396,154 @@ aminoacid::aminoacid(
         _pimpl->secondary_structure_name = "SHEET";
 }
 
-aminoacid aminoacid::component::get_residue() const
-{
-    // information-less aminoacid
-    aminoacid res;
+aminoacid::component::component(aminoacid const& res) : _residues{res._pimpl->table}, _res_index{res._pimpl->index}
+{}
 
-    // restore all of its information
-    res._pimpl = _res_pimpl.lock();
-    return res;
-}
+std::pmr::memory_resource* aminoacid::component::resource_of(aminoacid const& res)
+{ return res._pimpl->resource; }
 
-aminoacid::aminoacid() = default;
+aminoacid const& aminoacid::component::get_residue() const
+{ return (*_residues)[_res_index]; }
 
 aminoacid::~aminoacid() = default;
 
 std::array<double, 3> const& chemical_entity::aminoacid::get_position() const
 { return _pimpl->position; }
 
-atom::atom(gemmi::Atom const& record, aminoacid const& res) :
+double mass_of(gemmi::Element const& element)
+{
+    switch (element.elem)
+    {
+    case gemmi::El::H: return 1.008;
+    case gemmi::El::C: return 12.011;
+    case gemmi::El::N: return 14.007;
+    case gemmi::El::O: return 15.994;
+    case gemmi::El::S: return 32.065;
+    default: return element.weight();
+    }
+}
+
+double vdw_radius_of(gemmi::Element const& element)
+{
+    switch (element.elem)
+    {
+    case gemmi::El::S: return 1.89;
+    case gemmi::El::C: return 1.77;
+    case gemmi::El::O: return 1.55;
+    case gemmi::El::N: return 1.60;
+    default: return element.vdw_r();
+    }
+}
+
+atom_table::atom_table(std::pmr::memory_resource* resource) :
+    _name{resource}, _element{resource}, _roles{resource}, _charge{resource}, _vdw_opsl_index{resource},
+    _vdw_radius{resource}, _mass{resource}, _temp_factor{resource}, _serial{resource}
+{}
+
+uint32_t atom_table::append(gemmi::Atom const& record, aminoacid const& res)
+{
+    auto const row = static_cast<uint32_t>(size());
+    char const* symbol = gemmi::element_uppercase_name(record.element.elem);
+
+    _name.push_back(record.name);
+    _element.push_back(record.element.elem);
+    _roles.push_back(atom_roles::of(res.get_name(), record.name));
+    _charge.push_back(static_cast<int8_t>(record.charge > 0 ? 1 : record.charge < 0 ? -1 : 0));
+    _vdw_opsl_index.push_back(static_cast<int16_t>(get_vdw_opsl_values_index(res.get_name(), record.name, symbol)));
+    _vdw_radius.push_back(vdw_radius_of(record.element));
+    _mass.push_back(mass_of(record.element));
+    _temp_factor.push_back(record.b_iso);
+    _serial.push_back(record.serial);
+
+    return row;
+}
+
+void atom_table::truncate(size_t size)
+{
+    _vdw_radius.resize(size);
+    _mass.resize(size);
+
+    _name.resize(size);
+    _element.resize(size);
+    _roles.resize(size);
+    _charge.resize(size);
+    _vdw_opsl_index.resize(size);
+    _temp_factor.resize(size);
+    _serial.resize(size);
+}
+
+atom::atom(atom_table& table, gemmi::Atom const& record, aminoacid const& res) :
     kdpoint<3>({record.pos.x, record.pos.y, record.pos.z}),
     component(res),
-    _pimpl{std::make_shared<atom::impl>(record)}
+    _table{&table},
+    _row{table.append(record, res)}
 {}
 
 atom::~atom() = default;
 
 string const& atom::get_name() const
-{ return _pimpl->record.name; }
+{ return _table->_name[_row]; }
+
+char const* atom::get_symbol() const
+{ return gemmi::element_uppercase_name(_table->_element[_row]); }
 
-string atom::get_symbol() const
-{ return gemmi::element_uppercase_name(_pimpl->record.element.elem); }
+gemmi::El atom::get_element() const
+{ return _table->_element[_row]; }
 
 double atom::get_temp_factor() const
-{ return _pimpl->record.b_iso; }
+{ return _table->_temp_factor[_row]; }
 
 int atom::get_charge() const
-{
-    auto c = _pimpl->record.charge;
-    if (c > 0)
-        return 1;
-    if (c < 0)
-        return -1;
-    return 0;
-}
+{ return _table->_charge[_row]; }
 
 bool atom::is_hydrogen() const
-{ return _pimpl->record.is_hydrogen(); }
+{ return gemmi::Element{_table->_element[_row]}.is_hydrogen(); }
 
 bool atom::is_main_chain() const
-{
-    auto names = {"C", "O", "H", "HA", "N"};
-    return find(names.begin(), names.end(), get_name()) != names.end();
-}
+{ return _table->_roles[_row].has(atom_roles::MAIN_CHAIN); }
 
 int atom::get_atom_number() const
-{ return _pimpl->record.serial; }
+{ return _table->_serial[_row]; }
 
-double atom::get_mass() const
+atom atom::translated(array<double, 3> const& shift) const
 {
-    auto element = get_symbol();
-    if (element == "H") return 1.008;
-    if (element == "C") return 12.011;
-    if (element == "N") return 14.007;
-    if (element == "O") return 15.994;
-    if (element == "S") return 32.065;
-
-    return _pimpl->record.element.weight();
+    atom moved(*this);
+    moved._position = geom::sum<3>(_position, shift);
+    return moved;
 }
 
-double atom::get_vdw_radius() const
-{
-    string element = get_symbol();
-    if (element == "S") return 1.89;
-    if (element == "C") return 1.77;
-    if (element == "O") return 1.55;
-    if (element == "N") return 1.60;
+double atom::get_mass() const
+{ return _table->_mass[_row]; }
 
-    return _pimpl->record.element.vdw_r();
-}
+double atom::get_vdw_radius() const
+{ return _table->_vdw_radius[_row]; }
 
 bool atom::is_cation() const
-{
-    auto res_name = get_residue().get_name();
-
-    return (res_name == "LYS" && get_name() == "NZ")
-        || (res_name == "ARG" && get_name() == "NH2")
-        || (res_name == "HIS" && get_name() == "ND1");
-}
+{ return _table->_roles[_row].has(atom_roles::CATION); }
 
 bool atom::in_positive_ionic_group() const
-{
-    auto res_name = get_residue().get_name();
-    auto name = get_name();
-
-    if (res_name == "HIS")
-        return name == "CG" || name == "CD2" || name == "CE1" || name == "ND1" || name == "NE2";
-
-    else if (res_name == "ARG")
-        return name == "CZ" || name == "NH2" || name == "NH1" || name == "NE";
-
-    else if (res_name == "LYS")
-        return name == "NZ";
-
-    return false;
-}
+{ return _table->_roles[_row].has(atom_roles::POSITIVE_IONIC_GROUP); }
 
 bool chemical_entity::atom::in_negative_ionic_group() const
-{
-    auto res_name = get_residue().get_name();
-    auto name = get_name();
-
-    if (res_name == "GLU")
-        return name == "CD" || name == "OE1" || name == "OE2";
-
-    else if (res_name == "ASP")
-        return name == "CG" || name == "OD1" || name == "OD2";
-
-    return false;
-}
+{ return _table->_roles[_row].has(atom_roles::NEGATIVE_IONIC_GROUP); }
 
 bool atom::is_hydrogen_donor() const
-{
-    auto res_name = get_residue().get_name();
-    auto name = get_name();
-    return (res_name == "ARG" && (name == "NH1" || name == "NH2" || name == "NE"))
-        || (res_name == "ASN" && name == "ND2")
-        || (res_name == "GLN" && name == "NE2")
-        || (res_name == "HIS" && (name == "NE2" || name == "ND1"))
-        || (res_name == "LYS" && name == "NZ")
-        || (res_name == "SER" && name == "OG")
-        || (res_name == "THR" && name == "OG1")
-        || (res_name == "TRP" && name == "NE1")
-        || (res_name == "TYR" && name == "OH")
-        || name == "NH"
-        || name == "N";
-}
+{ return _table->_roles[_row].has(atom_roles::HYDROGEN_DONOR); }
 
 int atom::how_many_hydrogen_can_donate() const
-{
-    if (is_hydrogen_donor())
-    {
-        std::string res_name = get_residue().get_name();
-        std::string n = get_name();
-        if ((res_name == "ARG" && (n == "NH1" || n == "NH2")) ||
-            (res_name == "ASN" && n == "ND2") ||
-            (res_name == "GLN" && n == "NE2"))
-            return 2;
-        else if (res_name == "LYS" && n == "NZ")
-            return 3;
-        else
-            return 1;
-    }
-    else
-    {
-        return 0;
-    }
-}
+{ return _table->_roles[_row].donated; }
 
 bool atom::is_hydrogen_acceptor() const
-{
-    auto res_name = get_residue().get_name();
-    auto name = get_name();
-
-    return (res_name == "ASN" && name == "OD1")
-        || (res_name == "ASP" && (name == "OD1" || name == "OD2"))
-        || (res_name == "GLN" && name == "OE1")
-        || (res_name == "GLU" && (name == "OE1" || name == "OE2"))
-        || (res_name == "HIS" && (name == "ND1" || name == "NE2"))
-        || (res_name == "SER" && name == "OG")
-        || (res_name == "THR" && name == "OG1")
-        || (res_name == "TYR" && name == "OH")
-        //|| n == "C"
-        || name == "O";
-}
+{ return _table->_roles[_row].has(atom_roles::HYDROGEN_ACCEPTOR); }
 
 int atom::how_many_hydrogen_can_accept() const
-{
-    if (is_hydrogen_acceptor())
-    {
-        std::string res_name = get_residue().get_name();
-        std::string n = get_name();
-        if ((res_name == "ASN" && n == "OD1") ||
-            (res_name == "ASP" && (n == "OD1" || n == "OD2")) ||
-            (res_name == "GLN" && n == "OE1") ||
-            (res_name == "GLU" && (n == "OE1" || n == "OE2")) ||
-            (res_name == "SER" && n == "OG") ||
-            (res_name == "THR" && n == "OG1"))
-            return 2;
-        else
-            return 1;
-    }
-    else
-    {
-        return 0;
-    }
-}
+{ return _table->_roles[_row].accepted; }
 
 bool atom::is_vdw_candidate() const
-{
-    auto res_name = get_residue().get_name();
-    auto name = get_name();
-    auto element = get_symbol();
+{ return _table->_vdw_opsl_index[_row] > 0; }
 
-    return has_vdw_opsl_values(res_name, name, element);
-}
+int atom::get_vdw_opsl_index() const
+{ return _table->_vdw_opsl_index[_row]; }
 
 vector<atom> atom::get_attached_hydrogens() const
 {
@@ -596,9 +558,19 @@ vector<atom> atom::get_attached_hydrogens() const
     return hydrogens;
 }
 
-ring::ring(vector<atom> const& atoms, aminoacid const& res) : kdpoint<3>({0, 0, 0}), component(res)
+// rings with alternate locations may have more atoms than a block holds: they are left with an empty one
+geom::point_block<ring::max_atoms> block_of(vector<atom> const& atoms)
 {
-    auto tmp_pimpl = std::make_shared<impl>();
+    if (atoms.empty() || atoms.size() > ring::max_atoms)
+        return {};
+
+    return geom::point_block<ring::max_atoms>(atoms);
+}
+
+ring::ring(vector<atom> const& atoms, aminoacid const& res) :
+    kdpoint<3>({0, 0, 0}), component(res), _atom_block(block_of(atoms))
+{
+    auto tmp_pimpl = std::allocate_shared<impl>(std::pmr::polymorphic_allocator<impl>(resource_of(res)));
 
     tmp_pimpl->atoms = atoms;
 
@@ -626,18 +598,13 @@ bool ring::is_pication_candidate() const
 
 double ring::get_distance_between_closest_atoms(ring const& other) const
 {
-    double minimum = _pimpl->atoms[0].distance(other._pimpl->atoms[0]);
-    for (auto const& atom_1: _pimpl->atoms)
-    {
-        for (auto const& atom_2: other._pimpl->atoms)
-        {
-            double current = atom_1.distance(atom_2);
-            if (current < minimum)
-            {
-                minimum = current;
-            }
-        }
-    }
+    if (_atom_block.size > 0 && other._atom_block.size > 0)
+        return std::sqrt(geom::min_squared_distance(_atom_block, other._atom_block));
+
+    double minimum = std::numeric_limits<double>::infinity();
+    for (auto const& a: _pimpl->atoms)
+        for (auto const& b: other._pimpl->atoms)
+            minimum = std::min(minimum, a.distance(b));
 
     return minimum;
 }
@@ -654,8 +621,29 @@ double ring::get_angle_between_normal_and_centers_joining(ring const& other) con
 string ring::get_name() const
 { return get_name_from_atoms(_pimpl->atoms); }
 
+// images are only tested within a run of rin::maker, which must not allocate them from the arena of the model:
+// they take the default heap, and the rest of the ring (e.g. its normal) is the same
+ring ring::translated(array<double, 3> const& shift) const
+{
+    auto tmp_pimpl = std::make_shared<impl>();
+
+    tmp_pimpl->atoms.reserve(_pimpl->atoms.size());
+    for (auto const& a: _pimpl->atoms)
+        tmp_pimpl->atoms.push_back(a.translated(shift));
+
+    tmp_pimpl->normal = _pimpl->normal;
+
+    ring moved(*this);
+    moved._position = geom::sum<3>(_position, shift);
+    moved._atom_block = block_of(tmp_pimpl->atoms);
+    moved._pimpl = tmp_pimpl;
+
+    return moved;
+}
+
 ionic_group::ionic_group(vector<atom> const& atoms, int const& charge, aminoacid const& res) :
-    kdpoint<3>({0, 0, 0}), component(res), _pimpl{std::make_shared<impl>(atoms, charge)}
+    kdpoint<3>({0, 0, 0}), component(res),
+    _pimpl{std::allocate_shared<impl>(std::pmr::polymorphic_allocator<impl>(resource_of(res)), atoms, charge)}
 { _position = center_of_mass(atoms); }
 
 ionic_group::~ionic_group() = default;
@@ -678,3 +666,18 @@ double ionic_group::get_ionion_energy_q() const
 
 string ionic_group::get_name() const
 { return get_name_from_atoms(_pimpl->atoms); }
+
+// as the images of rings, on the default heap
+ionic_group ionic_group::translated(array<double, 3> const& shift) const
+{
+    vector<atom> atoms;
+    atoms.reserve(_pimpl->atoms.size());
+    for (auto const& a: _pimpl->atoms)
+        atoms.push_back(a.translated(shift));
+
+    ionic_group moved(*this);
+    moved._position = geom::sum<3>(_position, shift);
+    moved._pimpl = std::make_shared<impl>(atoms, _pimpl->charge);
+
+    return moved;
+}
@@ -4,6 +4,7 @@
 
 #include <string>
 #include <memory>
+#include <memory_resource>
 #include <vector>
 #include <optional>
 #include <array>
@@ -25,6 +26,16 @@ public:
 
     std::string chain_id;
 
+    // see aminoacid::aminoacid
+    chemical_entity::residue_table const* table = nullptr;
+    uint32_t index = 0;
+
+    // position of the first chain of the model with the same name
+    uint32_t chain_index = 0;
+
+    // the one of the atom table, which this is allocated from too (but not its strings and vectors)
+    std::pmr::memory_resource* resource = nullptr;
+
     std::string name;
 
     int sequence_number = 0;
@@ -36,15 +47,6 @@ public:
     std::array<double, 3> position;
 };
 
-struct chemical_entity::atom::impl final
-{
-public:
-    gemmi::Atom record;
-
-    explicit impl(gemmi::Atom  record) : record{std::move(record)}
-    {}
-};
-
 struct chemical_entity::ring::impl final
 {
 public:
@@ -2,31 +2,175 @@
 
 #include "rin_maker.h"
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <vector>
 #include <string>
+#include <variant>
 
 #include "ns_chemical_entity.h"
 
+#include "spatial/brute_force.h"
+#include "spatial/kdtree.h"
+#include "spatial/cell_grid.h"
+
+// neighbor search can be done with any of these (see rin::parameters::spatial_index_t and precision_t):
+// in the order of search_cost::algorithm, first in double and then in single precision
+template<typename T>
+using spatial_index = std::variant<
+    kdtree<T, 3>, cell_grid<T>, brute_force<T>,
+    kdtree<T, 3, float>, cell_grid<T, float>, brute_force<T, float>>;
+
+// position in one of the entity tables of rin::maker::impl
+using entity_id = uint32_t;
+
+// alternatives of spatial_index in each precision
+constexpr size_t algorithm_count = std::variant_size_v<spatial_index<entity_id>> / 2;
+
+// every search is either a self-join or a join of two of these indices
+enum class index_slot : size_t
+{
+    HDONOR, HACCEPTOR, VDW, CATION, // atoms
+    RING, PICATION_RING, // rings
+    POSITIVE_ION, NEGATIVE_ION, // ionic groups
+    ALPHA_CARBON, BETA_CARBON, // atoms
+    COUNT
+};
+
+constexpr size_t index_count = static_cast<size_t>(index_slot::COUNT);
+
+/**
+ * What a spatial index is built over: indices are only built when a search needs them
+ * (see rin::maker::impl::index and rin::neighbor_lists::impl::index).
+ */
+struct index_spec
+{
+    // positions of the entities of a table (ids are positions in it)
+    std::vector<std::array<double, 3>> const* positions = nullptr;
+
+    std::vector<entity_id> ids;
+
+    // cell grids are tuned for it
+    double query_dist = 0;
+
+    // the alternative of spatial_index to be built
+    size_t kind = 0;
+};
+
+spatial_index<entity_id> make_index(index_spec const& spec);
+
 struct rin::maker::impl
 {
 public:
+    // the columns of the atom table, the impls of the entities (with their reference counts) and the ss bonds
+    // of the model are allocated here, and released all at once with it; the strings and vectors inside the impls
+    // (names, lists of atoms) are not, since the getters return them as std::string and std::vector.
+    // It is declared first, so that it outlives everything else
+    std::pmr::monotonic_buffer_resource arena;
+
     std::vector<chemical_entity::aminoacid> aminoacids;
 
-    kdtree<chemical_entity::atom, 3> hdonor_tree, vdw_tree;
-    std::vector<chemical_entity::atom> hacceptor_vector, vdw_vector, cation_vector;
+    // the columns of the atoms of the aminoacids, which they are views of
+    chemical_entity::atom_table atom_rows{&arena};
 
-    kdtree<chemical_entity::ring, 3> ring_tree, pication_ring_tree;
-    std::vector<chemical_entity::ring> ring_vector, pication_ring_vector;
+    // every entity of the model is stored once, in one of these tables: the indices only hold their ids
+    std::vector<chemical_entity::atom> atoms;
+    std::vector<chemical_entity::ring> rings;
+    std::vector<chemical_entity::ionic_group> ionic_groups;
 
-    kdtree<chemical_entity::ionic_group, 3> positive_ion_tree;
-    std::vector<chemical_entity::ionic_group> negative_ion_vector;
+    // positions of the entities of each table, as searched (see wraps)
+    std::vector<std::array<double, 3>> atom_positions, ring_positions, ionic_positions;
 
-    kdtree<chemical_entity::atom, 3> alpha_carbon_tree, beta_carbon_tree;
-    std::vector<chemical_entity::atom> alpha_carbon_vector, beta_carbon_vector;
+    // by index_slot
+    std::array<index_spec, index_count> specs;
+
+    // the indices of the runs without neighbor lists, built the first time that a run needs them
+    struct built_index
+    {
+        std::once_flag once;
+        spatial_index<entity_id> index;
+    };
+
+    mutable std::array<built_index, index_count> indices;
+
+    // the index of slot, built on the first call (calls may be concurrent)
+    spatial_index<entity_id> const& index(index_slot slot) const;
 
     // ss bonds are directly parsed, not computed by us
     std::vector<std::shared_ptr<bond::ss const>> ss_bonds;
 
     std::string pdb_name;
+
+    // periodic box of the model, if searches follow the minimum image convention
+    std::optional<geom::lattice> box;
+
+    // translations of the aminoacids into the box, by position (none without it): the indices are built over
+    // the translated entities, while the entities themselves keep the coordinates of the input
+    std::vector<std::array<double, 3>> wraps;
+};
+
+/**
+ * Candidate pairs of one family of bonds, found at its query distance plus the skin.
+ */
+struct pair_list
+{
+    struct candidate
+    {
+        entity_id first;
+        entity_id second;
+
+        // the first entity is close to the second one in its image first - shift
+        std::array<double, 3> shift;
+    };
+
+    std::vector<candidate> candidates;
+
+    // query distance the candidates were found for
+    double query_dist = 0;
+
+    bool stale = true;
+};
+
+struct rin::neighbor_lists::impl
+{
+public:
+    double skin = 0;
+
+    // positions of the atoms when the lists were last built:
+    // rings and ionic groups are centred on their atoms, so they never move farther than the farthest atom
+    geom::point_array<3> reference;
+
+    // sizes of the other tables when the lists were last built
+    size_t rings = 0, ionic_groups = 0;
+
+    // one list per family of bonds
+    std::map<std::string, pair_list> lists;
+
+    // the indices searched for the stale lists, kept from one frame to the next: when a list goes stale again,
+    // its kdtrees are refitted to the new positions, and the other indices are built again
+    struct kept_index
+    {
+        std::optional<spatial_index<entity_id>> index;
+        index_spec spec;
+    };
+
+    std::array<kept_index, index_count> indices;
+
+    // the indices already updated in the current run (see maker::run)
+    std::array<bool, index_count> updated{};
+
+    // indices built or refitted so far (different indices may be updated concurrently)
+    std::atomic<size_t> index_updates{0};
+
+    // the index of slot over the entities of spec, updated on its first call in each run
+    spatial_index<entity_id> const& index(index_spec const& spec, index_slot slot);
+
+    // checks the lists against the entities of a new frame, and marks them all stale if needed
+    void refresh(std::vector<chemical_entity::atom> const& atoms, size_t ring_count, size_t ionic_group_count);
 };
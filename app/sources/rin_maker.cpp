@@ -5,8 +5,17 @@
 #include <map>
 #include <set>
 #include <unordered_map>
+#include <stdexcept>
+#include <limits>
+#include <array>
+#include <algorithm>
+#include <tuple>
 
+#include <chrono>
 #include <optional>
+#include <future>
+#include <memory_resource>
+#include <variant>
 
 #include <utility>
 
@@ -16,6 +25,9 @@
 #include "rin_params.h"
 #include "log_manager.h"
 #include "spatial/kdtree.h"
+#include "spatial/cell_grid.h"
+#include "spatial/brute_force.h"
+#include "spatial/search_cost.h"
 
 #include "private/impl_rin_maker.h"
 
@@ -141,7 +153,143 @@ void warn_if_not_protein(std::vector<chemical_entity::aminoacid> const& residues
     lm::main()->warn("it seems that the pdb/cif file does not contain any valid aminoacid!");
 }
 
+/**
+ * Builds a spatial index over a subset of an entity table: ids[i] is at positions[ids[i]].
+ * <br/>
+ * Cell grids are tuned for one query distance, that is the edge of their cells.
+ */
+template<typename Real>
+spatial_index<entity_id> make_index(
+    vector<std::array<double, 3>> const& positions, vector<entity_id> const& ids, double query_dist,
+    search_cost::algorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case search_cost::algorithm::CELL_GRID:
+        return cell_grid<entity_id, Real>(positions, ids, query_dist);
+
+    case search_cost::algorithm::BRUTE_FORCE:
+        return brute_force<entity_id, Real>(positions, ids);
+
+    case search_cost::algorithm::KDTREE:
+    default:
+        return kdtree<entity_id, 3, Real>(
+            positions, ids, kdtree<entity_id, 3, Real>::default_bucket_size, cfg::params::parallel_build_threshold);
+    }
+}
+
+spatial_index<entity_id> make_index(index_spec const& spec)
+{
+    auto const algorithm = static_cast<search_cost::algorithm>(spec.kind % algorithm_count);
+    return spec.kind >= algorithm_count
+           ? make_index<float>(*spec.positions, spec.ids, spec.query_dist, algorithm)
+           : make_index<double>(*spec.positions, spec.ids, spec.query_dist, algorithm);
+}
+
+/**
+ * The algorithm of the searches of one family of bonds: the one chosen by the user, or the cheapest one
+ * according to the cost model, which is logged with its estimates.
+ */
+search_cost::algorithm choose_algorithm(
+    string const& family, search_cost::estimate const& cost, parameters const& params)
+{
+    switch (params.spatial_index())
+    {
+    case parameters::spatial_index_t::KDTREE:
+        return search_cost::algorithm::KDTREE;
+
+    case parameters::spatial_index_t::CELL_GRID:
+        return search_cost::algorithm::CELL_GRID;
+
+    case parameters::spatial_index_t::BRUTE_FORCE:
+        return search_cost::algorithm::BRUTE_FORCE;
+
+    case parameters::spatial_index_t::AUTO:
+    default:
+        break;
+    }
+
+    auto const best = cost.best();
+    lm::main()->info(
+        "{}: {} (estimates: kdtree {:.3f} ms, cell grid {:.3f} ms, brute force {:.3f} ms)",
+        family, search_cost::name(best),
+        cost.of(search_cost::algorithm::KDTREE) / 1e6,
+        cost.of(search_cost::algorithm::CELL_GRID) / 1e6,
+        cost.of(search_cost::algorithm::BRUTE_FORCE) / 1e6);
+
+    return best;
+}
+
+/**
+ * Positions of the entities of a table, in the same order, each one moved by the wrap of its residue (if any).
+ */
+template<typename Entity>
+vector<std::array<double, 3>> positions_of(vector<Entity> const& table, vector<std::array<double, 3>> const& wraps)
+{
+    vector<std::array<double, 3>> positions;
+    positions.reserve(table.size());
+    for (auto const& e: table)
+    {
+        auto const& p = static_cast<std::array<double, 3> const&>(e);
+        positions.push_back(wraps.empty() ? p : geom::sum<3>(p, wraps[e.get_residue_index()]));
+    }
+
+    return positions;
+}
+
+/**
+ * Translations that move each aminoacid, as a whole, into the unit cell: the lattice vectors times
+ * the cells that its centre is away from it.
+ */
+vector<std::array<double, 3>> wraps_of(
+    vector<aminoacid> const& aminoacids, gemmi::UnitCell const& cell, geom::lattice const& box)
+{
+    vector<std::array<double, 3>> wraps;
+    wraps.reserve(aminoacids.size());
+    for (auto const& res: aminoacids)
+    {
+        if (res.get_atoms().empty())
+        {
+            wraps.push_back({});
+            continue;
+        }
+
+        gemmi::Position centre{0, 0, 0};
+        for (auto const& a: res.get_atoms())
+        {
+            auto const& p = static_cast<std::array<double, 3> const&>(a);
+            centre += gemmi::Position{p[0], p[1], p[2]};
+        }
+
+        auto const frac = cell.fractionalize(centre / static_cast<double>(res.get_atoms().size()));
+        wraps.push_back(box.shift(
+            -static_cast<int>(std::floor(frac.x)),
+            -static_cast<int>(std::floor(frac.y)),
+            -static_cast<int>(std::floor(frac.z))));
+    }
+
+    return wraps;
+}
+
+/**
+ * Appends entity to table and returns its id.
+ */
+template<typename Entity>
+entity_id add_entity(vector<Entity>& table, Entity const& entity)
+{
+    if (table.size() > std::numeric_limits<entity_id>::max())
+        throw runtime_error("too many entities in a single model");
+
+    table.push_back(entity);
+    return static_cast<entity_id>(table.size() - 1);
+}
+
 rin::maker::maker(gemmi::Model const& model, gemmi::Structure const& protein,  rin::parameters const& params)
+    : maker(model, protein, params, params.precision() == parameters::precision_t::SINGLE)
+{}
+
+rin::maker::maker(
+    gemmi::Model const& model, gemmi::Structure const& protein, rin::parameters const& params, bool single_precision)
 {
     secondary_structure_helper_map<gemmi::Helix> helix_map;
     for (auto const& helix: protein.helices)
@@ -160,17 +308,18 @@ rin::maker::maker(gemmi::Model const& model, gemmi::Structure const& protein,  r
         [&helix_map, &strand_map, &tmp_pimpl, &model, &protein, &params]
         (auto const& residue, auto const& chain)
     {
+        auto const atom_rows = tmp_pimpl->atom_rows.size();
         try
         {
             if (helix_map.empty() && strand_map.empty())
-                tmp_pimpl->aminoacids.emplace_back(residue, chain, model, protein, params);
+                tmp_pimpl->aminoacids.emplace_back(tmp_pimpl->aminoacids, tmp_pimpl->atom_rows, residue, chain, model, protein, params);
             else
             {
                 std::optional<std::variant<gemmi::Helix, gemmi::Sheet::Strand>> maybe_sstruct{std::nullopt};
                 if (!(maybe_sstruct = helix_map.maybe_find(residue, chain)).has_value())
                     maybe_sstruct = strand_map.maybe_find(residue, chain);
 
-                tmp_pimpl->aminoacids.emplace_back(residue, chain, model, protein, params, maybe_sstruct);
+                tmp_pimpl->aminoacids.emplace_back(tmp_pimpl->aminoacids, tmp_pimpl->atom_rows, residue, chain, model, protein, params, maybe_sstruct);
             }
         }
         catch (std::exception const& e)
@@ -182,6 +331,9 @@ rin::maker::maker(gemmi::Model const& model, gemmi::Structure const& protein,  r
             }
             else
                 lm::main()->warn("skipping residue: {}", e.what());
+
+            // the atoms of a skipped residue are not referred to by anything
+            tmp_pimpl->atom_rows.truncate(atom_rows);
         }
     };
 
@@ -198,47 +350,60 @@ rin::maker::maker(gemmi::Model const& model, gemmi::Structure const& protein,  r
 
     lm::main()->info("extracting ionic groups, rings and other entities...");
 
-    // these are used only to build the corresponding kdtrees
-    vector<atom> hdonors;
-    vector<ionic_group> positives;
+    // these are used only to build the corresponding spatial indices;
+    // entities are stored once in the tables of the model, and the indices over them only hold their ids
+    vector<entity_id> hdonors, hacceptors, vdw_candidates, cations, alpha_carbons, beta_carbons;
+    vector<entity_id> rings, pication_rings;
+    vector<entity_id> positives, negatives;
 
     for (auto const& res: tmp_pimpl->aminoacids)
     {
-        if (auto const& ca = res.get_alpha_carbon(); ca.has_value())
-            tmp_pimpl->alpha_carbon_vector.push_back(*ca);
-
-        if (auto const& cb = res.get_beta_carbon(); cb.has_value())
-            tmp_pimpl->beta_carbon_vector.push_back(*cb);
-
+        optional<entity_id> ca, cb;
         for (auto const& a : res.get_atoms())
         {
+            auto const id = add_entity(tmp_pimpl->atoms, a);
+
+            // the same atoms of get_alpha_carbon and get_beta_carbon: the last ones with that name
+            if (a.get_name() == "CA")
+                ca = id;
+
+            else if (a.get_name() == "CB")
+                cb = id;
+
             if (a.is_hydrogen_donor())
-                hdonors.push_back(a);
+                hdonors.push_back(id);
 
             if (a.is_hydrogen_acceptor())
-                tmp_pimpl->hacceptor_vector.push_back(a);
+                hacceptors.push_back(id);
 
             if (a.is_vdw_candidate())
-                tmp_pimpl->vdw_vector.push_back(a);
+                vdw_candidates.push_back(id);
 
             if (a.is_cation())
-                tmp_pimpl->cation_vector.push_back(a);
+                cations.push_back(id);
         }
 
+        if (ca.has_value())
+            alpha_carbons.push_back(*ca);
+
+        if (cb.has_value())
+            beta_carbons.push_back(*cb);
+
         if (auto const& pos_group = res.get_positive_ionic_group(); pos_group.has_value())
-            positives.push_back(*pos_group);
+            positives.push_back(add_entity(tmp_pimpl->ionic_groups, *pos_group));
 
         if (auto const& neg_group = res.get_negative_ionic_group(); neg_group.has_value())
-            tmp_pimpl->negative_ion_vector.push_back(*neg_group);
+            negatives.push_back(add_entity(tmp_pimpl->ionic_groups, *neg_group));
 
         auto const ring_setup = [&](std::optional<ring> const& ring)
         {
             if (ring.has_value())
             {
-                tmp_pimpl->ring_vector.push_back(*ring);
+                auto const id = add_entity(tmp_pimpl->rings, *ring);
+                rings.push_back(id);
 
                 if (ring->is_pication_candidate())
-                    tmp_pimpl->pication_ring_vector.push_back(*ring);
+                    pication_rings.push_back(id);
             }
         };
 
@@ -246,37 +411,275 @@ rin::maker::maker(gemmi::Model const& model, gemmi::Structure const& protein,  r
         ring_setup(res.get_secondary_ring());
     }
 
-    lm::main()->info("hydrogen acceptors: {}", tmp_pimpl->hacceptor_vector.size());
+    lm::main()->info("hydrogen acceptors: {}", hacceptors.size());
     lm::main()->info("hydrogen donors: {}", hdonors.size());
-    lm::main()->info("vdw candidates: {}", tmp_pimpl->vdw_vector.size());
-    lm::main()->info("cations: {}", tmp_pimpl->cation_vector.size());
-    lm::main()->info("aromatic rings (total): {}", tmp_pimpl->ring_vector.size());
-    lm::main()->info("aromatic rings (cation-pi only): {}", tmp_pimpl->pication_ring_vector.size());
+    lm::main()->info("vdw candidates: {}", vdw_candidates.size());
+    lm::main()->info("cations: {}", cations.size());
+    lm::main()->info("aromatic rings (total): {}", rings.size());
+    lm::main()->info("aromatic rings (cation-pi only): {}", pication_rings.size());
+
+    if (params.periodic() && protein.cell.is_crystal())
+    {
+        // the lattice vectors are the columns of the orthogonalization matrix
+        auto const& orth = protein.cell.orth.mat.a;
+        geom::lattice box{};
+        for (size_t v = 0; v < 3; ++v)
+            for (size_t axis = 0; axis < 3; ++axis)
+                box.vectors[v][axis] = orth[axis][v];
+
+        lm::main()->info("periodic box: {} x {} x {}", protein.cell.a, protein.cell.b, protein.cell.c);
+        if (params.interaction_type() == parameters::interaction_type_t::CONTACT_MAP)
+            lm::main()->warn("contact maps do not support periodic boundary conditions: they will be ignored");
+
+        tmp_pimpl->box = box;
+    }
+
+    // searches follow the minimum image convention over the aminoacids wrapped, as a whole, into the unit cell,
+    // so that the images of the 26 neighboring cells are enough; the entities keep the coordinates of the input
+    if (tmp_pimpl->box.has_value() && params.interaction_type() != parameters::interaction_type_t::CONTACT_MAP)
+        tmp_pimpl->wraps = wraps_of(tmp_pimpl->aminoacids, protein.cell, *tmp_pimpl->box);
+
+    lm::main()->info("choosing spatial indices ({} precision)...", single_precision ? "single" : "double");
+
+    // indices are only built when a search needs them (see run): here, each one is only specified
+    tmp_pimpl->atom_positions = positions_of(tmp_pimpl->atoms, tmp_pimpl->wraps);
+    tmp_pimpl->ring_positions = positions_of(tmp_pimpl->rings, tmp_pimpl->wraps);
+    tmp_pimpl->ionic_positions = positions_of(tmp_pimpl->ionic_groups, tmp_pimpl->wraps);
+
+    auto const specify = [&tmp_pimpl, single_precision](
+        index_slot slot, vector<std::array<double, 3>> const& positions, vector<entity_id>& ids, double query_dist,
+        search_cost::algorithm algorithm)
+    {
+        auto& spec = tmp_pimpl->specs[static_cast<size_t>(slot)];
+        spec.positions = &positions;
+        spec.ids = std::move(ids);
+        spec.query_dist = query_dist;
+        spec.kind = static_cast<size_t>(algorithm) + (single_precision ? algorithm_count : 0);
+    };
+
+    // both sides of a join must be indices of the same kind: the algorithm is chosen per family of bonds
+    auto const specify_join = [&specify, &params](
+        string const& family, index_slot slot1, auto const& positions1, auto& ids1,
+        index_slot slot2, auto const& positions2, auto& ids2, double query_dist)
+    {
+        auto const cost = search_cost::join(
+            search_cost::side::of(positions1, ids1), search_cost::side::of(positions2, ids2), query_dist);
+        auto const algorithm = choose_algorithm(family, cost, params);
 
-    lm::main()->info("building kdtrees...");
+        specify(slot1, positions1, ids1, query_dist, algorithm);
+        specify(slot2, positions2, ids2, query_dist, algorithm);
+    };
+
+    auto const specify_self_join = [&specify, &params](
+        string const& family, index_slot slot, auto const& positions, auto& ids, double query_dist)
+    {
+        auto const cost = search_cost::self_join(search_cost::side::of(positions, ids), query_dist);
+        specify(slot, positions, ids, query_dist, choose_algorithm(family, cost, params));
+    };
 
-    tmp_pimpl->hdonor_tree = kdtree<atom, 3>(hdonors);
-    tmp_pimpl->vdw_tree = kdtree<atom, 3>(tmp_pimpl->vdw_vector);
+    auto const& atom_positions = tmp_pimpl->atom_positions;
+    auto const& ring_positions = tmp_pimpl->ring_positions;
+    auto const& ionic_positions = tmp_pimpl->ionic_positions;
 
-    tmp_pimpl->ring_tree = kdtree<ring, 3>(tmp_pimpl->ring_vector);
-    tmp_pimpl->pication_ring_tree = kdtree<ring, 3>(tmp_pimpl->pication_ring_vector);
-    tmp_pimpl->positive_ion_tree = kdtree<ionic_group, 3>(positives);
+    specify_join(
+        "hydrogen", index_slot::HACCEPTOR, atom_positions, hacceptors,
+        index_slot::HDONOR, atom_positions, hdonors, params.query_dist_hbond());
+    specify_self_join("vdw", index_slot::VDW, atom_positions, vdw_candidates, params.query_dist_vdw());
 
-    tmp_pimpl->alpha_carbon_tree = kdtree<atom, 3>(tmp_pimpl->alpha_carbon_vector);
-    tmp_pimpl->beta_carbon_tree = kdtree<atom, 3>(tmp_pimpl->beta_carbon_vector);
+    specify_self_join("pipistack", index_slot::RING, ring_positions, rings, params.query_dist_pipi());
+    specify_join(
+        "pication", index_slot::CATION, atom_positions, cations,
+        index_slot::PICATION_RING, ring_positions, pication_rings, params.query_dist_pica());
+
+    specify_join(
+        "ionic", index_slot::NEGATIVE_ION, ionic_positions, negatives,
+        index_slot::POSITIVE_ION, ionic_positions, positives, params.query_dist_ionic());
+
+    // alpha carbons are used both by contact maps and by hydrophobic bonds
+    auto const alpha_query_dist =
+        params.interaction_type() == parameters::interaction_type_t::CONTACT_MAP
+        ? params.query_dist_cmap()
+        : cfg::params::query_dist_hydrophobic;
+
+    auto const alpha_family =
+        params.interaction_type() == parameters::interaction_type_t::CONTACT_MAP ? "contact" : "hydrophobic";
+
+    specify_self_join(alpha_family, index_slot::ALPHA_CARBON, atom_positions, alpha_carbons, alpha_query_dist);
+    specify_self_join("contact", index_slot::BETA_CARBON, atom_positions, beta_carbons, params.query_dist_cmap());
 
     for (auto const& connection : protein.connections)
         if (connection.type == gemmi::Connection::Type::Disulf)
-            tmp_pimpl->ss_bonds.push_back(std::make_shared<bond::ss>(connection));
+        {
+            tmp_pimpl->ss_bonds.push_back(
+                std::allocate_shared<bond::ss>(bond::allocator(&tmp_pimpl->arena), connection));
+        }
 
     pimpl = tmp_pimpl;
 }
 
 rin::maker::~maker() = default;
 
+rin::neighbor_lists::neighbor_lists(double skin) : pimpl{make_shared<impl>()}
+{ pimpl->skin = skin; }
+
+rin::neighbor_lists::~neighbor_lists() = default;
+
+/**
+ * Tests a pair found by a periodic search, where e1 - shift is the image of e1 that is close to e2.
+ */
 template<typename Bond, typename Entity1, typename Entity2>
+shared_ptr<Bond const> test_image(
+    parameters const& params, Entity1 const& e1, Entity2 const& e2, std::array<double, 3> const& shift,
+    bond::allocator const& alloc)
+{
+    if (shift == std::array<double, 3>{})
+        return Bond::test(params, e1, e2, alloc);
+
+    return Bond::test(params, e1.translated(geom::difference<3>({}, shift)), e2, alloc);
+}
+
+/**
+ * Join: calls visitor(id1, id2, shift) for each pair of entities within dist from each other,
+ * the first one from index1 and the second one from index2.
+ * <br/>
+ * The shift is always zero, unless the search follows the minimum image convention in box.
+ */
+template<typename Visitor>
+void for_each_candidate(
+    spatial_index<entity_id> const& index1, spatial_index<entity_id> const& index2,
+    double dist, optional<geom::lattice> const& box, Visitor&& visitor)
+{
+    std::visit(
+        [dist, &box, &visitor](auto const& actual_index1, auto const& actual_index2)
+        {
+            using Index1 = std::decay_t<decltype(actual_index1)>;
+            using Index2 = std::decay_t<decltype(actual_index2)>;
+
+            // make_index builds all the indices of the same kind, so mixed pairs never show up
+            if constexpr (std::is_same_v<Index1, Index2>)
+            {
+                if (box.has_value())
+                    actual_index1.for_each_pair_within(actual_index2, dist, *box, visitor);
+                else
+                    actual_index1.for_each_pair_within(actual_index2, dist, [&visitor](entity_id id1, entity_id id2)
+                    { visitor(id1, id2, std::array<double, 3>{}); });
+            }
+            else
+                throw std::logic_error("find_bonds: cannot join different kinds of spatial index");
+        },
+        index1, index2);
+}
+
+/**
+ * Self-join: as above, for each unordered pair of entities in the index, exactly once.
+ * <br/>
+ * Pairs are oriented by id (id1 < id2), whatever the storage order of the index.
+ */
+template<typename Visitor>
+void for_each_candidate(
+    spatial_index<entity_id> const& index, double dist, optional<geom::lattice> const& box, Visitor&& visitor)
+{
+    // if id1 - shift is close to id2, then id2 + shift is close to id1
+    auto const oriented = [&visitor](entity_id id1, entity_id id2, std::array<double, 3> const& shift)
+    {
+        if (id1 < id2)
+            visitor(id1, id2, shift);
+        else
+            visitor(id2, id1, geom::difference<3>({}, shift));
+    };
+
+    std::visit(
+        [dist, &box, &oriented](auto const& actual_index)
+        {
+            if (box.has_value())
+                actual_index.for_each_pair_within(dist, *box, oriented);
+            else
+                actual_index.for_each_pair_within(dist, [&oriented](entity_id id1, entity_id id2)
+                { oriented(id1, id2, std::array<double, 3>{}); });
+        },
+        index);
+}
+
+/**
+ * Kind of a spatial index, for the logs.
+ */
+string kind_of(spatial_index<entity_id> const& index)
+{
+    string kind = search_cost::name(static_cast<search_cost::algorithm>(index.index() % algorithm_count));
+    if (index.index() >= algorithm_count)
+        kind += ", single precision";
+
+    return kind;
+}
+
+/**
+ * Runs search, and logs how long it took (tests of the candidates included).
+ */
+template<typename Search>
+void timed(string const& family, spatial_index<entity_id> const& index, Search&& search)
+{
+    auto const start = std::chrono::steady_clock::now();
+    search();
+    std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now() - start;
+
+    lm::main()->info("{} search ({}): {:.3f} ms", family, kind_of(index), elapsed.count());
+}
+
+// the index of a slot, built (or updated) on demand: see rin::maker::run
+using index_getter = std::function<spatial_index<entity_id> const&(index_slot)>;
+
+/**
+ * Searches to be run by find_bonds: search(dist, visitor) enumerates the candidate pairs within dist.
+ * <br/>
+ * The indices are only got when the search is run, so that the ones of fresh neighbor lists are never built.
+ */
+auto joining(
+    string const& family, index_getter const& index_of, index_slot slot1, index_slot slot2,
+    optional<geom::lattice> const& box)
+{
+    return [family, &index_of, slot1, slot2, &box](double dist, auto&& visitor)
+    {
+        auto const& index1 = index_of(slot1);
+        auto const& index2 = index_of(slot2);
+        timed(family, index1, [&] { for_each_candidate(index1, index2, dist, box, visitor); });
+    };
+}
+
+auto self_joining(
+    string const& family, index_getter const& index_of, index_slot slot, optional<geom::lattice> const& box)
+{
+    return [family, &index_of, slot, &box](double dist, auto&& visitor)
+    {
+        auto const& index = index_of(slot);
+        timed(family, index, [&] { for_each_candidate(index, dist, box, visitor); });
+    };
+}
+
+/**
+ * Whether the candidates of a family of bonds must be searched again: always, without a neighbor list.
+ */
+bool needs_search(pair_list const* list, double dist)
+{ return list == nullptr || list->stale || list->query_dist != dist; }
+
+/**
+ * Tests the candidate pairs enumerated by search, with the first entity of each pair from table1
+ * and the second one from table2.
+ * <br/>
+ * Self-joins are only meant for bonds whose test is symmetric, i.e. such that Bond::test(a, b) and Bond::test(b, a)
+ * are the same bond.
+ * <br/>
+ * The indices may be built over the entities moved by the wraps of their residues: the shifts of the candidates
+ * are brought back to the coordinates of the entities.
+ * <br/>
+ * With a neighbor list, the search is only run when the list is stale, at dist plus the skin;
+ * otherwise the candidates of the list are just checked again against dist, at the current positions.
+ */
+template<typename Bond, typename Entity1, typename Entity2, typename Search>
 vector<shared_ptr<Bond const>>
-find_bonds(vector<Entity1> const& vec, kdtree<Entity2, 3> const& tree, double dist, parameters const& params)
+find_bonds(
+    vector<Entity1> const& table1, vector<Entity2> const& table2, Search&& search,
+    double dist, parameters const& params, vector<std::array<double, 3>> const& wraps,
+    pair_list* list, double skin, bond::allocator const& alloc)
 {
     static_assert(
         std::is_base_of_v<aminoacid::component, Entity1>,
@@ -289,20 +692,161 @@ find_bonds(vector<Entity1> const& vec, kdtree<Entity2, 3> const& tree, double di
         "template typename Bond must inherit from type bond::base");
 
     vector<shared_ptr<Bond const>> bonds;
-    for (auto const& e1 : vec)
+    auto const test = [&bonds, &table1, &table2, &params, &alloc](
+        entity_id id1, entity_id id2, std::array<double, 3> const& shift)
     {
-        auto neighbors = tree.range_search(e1, dist);
-        for (auto const& e2 : neighbors)
+        auto bond = test_image<Bond>(params, table1[id1], table2[id2], shift, alloc);
+        if (bond != nullptr)
+            bonds.emplace_back(bond);
+    };
+
+    // candidates are tested in the order of their ids, so that the bonds (and the ties of the filters)
+    // do not depend on the kind of the indices, nor on their precision
+    auto const collect = [&search, &table1, &table2, &wraps](
+        double query_dist, vector<pair_list::candidate>& candidates)
+    {
+        candidates.clear();
+        search(query_dist, [&](entity_id id1, entity_id id2, std::array<double, 3> const& shift)
         {
-            auto bond = Bond::test(params, e1, e2);
-            if (bond != nullptr)
-                bonds.emplace_back(bond);
-        }
+            if (wraps.empty())
+            {
+                candidates.push_back({id1, id2, shift});
+                return;
+            }
+
+            // e1 + w1 - shift is close to e2 + w2, at the wrapped positions searched
+            auto const& w1 = wraps[table1[id1].get_residue_index()];
+            auto const& w2 = wraps[table2[id2].get_residue_index()];
+            candidates.push_back({id1, id2, geom::sum<3>(geom::difference<3>(shift, w1), w2)});
+        });
+
+        std::sort(candidates.begin(), candidates.end(), [](auto const& a, auto const& b)
+        { return std::tie(a.first, a.second, a.shift) < std::tie(b.first, b.second, b.shift); });
+    };
+
+    if (list == nullptr)
+    {
+        vector<pair_list::candidate> candidates;
+        collect(dist, candidates);
+        for (auto const& c: candidates)
+            test(c.first, c.second, c.shift);
+
+        return bonds;
+    }
+
+    if (needs_search(list, dist))
+    {
+        collect(dist + skin, list->candidates);
+
+        list->query_dist = dist;
+        list->stale = false;
+    }
+
+    // the same check of the indices
+    for (auto const& c: list->candidates)
+    {
+        auto const p1 = geom::difference<3>(static_cast<std::array<double, 3> const&>(table1[c.first]), c.shift);
+        if (geom::distance<3>(static_cast<std::array<double, 3> const&>(table2[c.second]), p1) <= dist)
+            test(c.first, c.second, c.shift);
     }
 
     return bonds;
 }
 
+spatial_index<entity_id> const& rin::maker::impl::index(index_slot slot) const
+{
+    auto const i = static_cast<size_t>(slot);
+    std::call_once(indices[i].once, [this, i]
+    { indices[i].index = make_index(specs[i]); });
+
+    return indices[i].index;
+}
+
+template<typename Index>
+constexpr bool is_kdtree = false;
+
+template<typename Real>
+constexpr bool is_kdtree<kdtree<entity_id, 3, Real>> = true;
+
+/**
+ * The kdtrees of the previous frame are refitted to the positions of this one, as long as they are over the same
+ * entities and for the same query distance (the topology is the same, see neighbor_lists); the other kinds of
+ * index have nothing to keep, and are built again.
+ */
+spatial_index<entity_id> const& rin::neighbor_lists::impl::index(index_spec const& spec, index_slot slot)
+{
+    auto const i = static_cast<size_t>(slot);
+    auto& kept = indices[i];
+    if (updated[i])
+        return *kept.index;
+
+    bool const same =
+        kept.index.has_value() && kept.spec.kind == spec.kind && kept.spec.query_dist == spec.query_dist &&
+        kept.spec.ids == spec.ids;
+
+    bool refitted = false;
+    if (same)
+    {
+        std::visit([&spec, &refitted](auto& index)
+        {
+            if constexpr (is_kdtree<std::decay_t<decltype(index)>>)
+            {
+                index.refit([&spec](entity_id id)
+                { return (*spec.positions)[id]; });
+                refitted = true;
+            }
+        }, *kept.index);
+    }
+
+    if (!refitted)
+    {
+        kept.index = make_index(spec);
+        kept.spec = spec;
+
+        // the positions are the ones of the model, which does not outlive its frame
+        kept.spec.positions = nullptr;
+    }
+
+    updated[i] = true;
+    ++index_updates;
+
+    return *kept.index;
+}
+
+size_t rin::neighbor_lists::index_updates() const
+{ return pimpl->index_updates; }
+
+/**
+ * The lists go stale as soon as a table changes, or an atom has moved more than half of the skin since they were built.
+ */
+void rin::neighbor_lists::impl::refresh(vector<atom> const& atoms, size_t ring_count, size_t ionic_group_count)
+{
+    // a new run: the indices it searches are updated again (see index)
+    updated.fill(false);
+
+    geom::point_array<3> positions(atoms);
+
+    bool stale = reference.size() != positions.size() || rings != ring_count || ionic_groups != ionic_group_count;
+    if (!stale)
+    {
+        vector<double> displacements(positions.size());
+        geom::distances<3>(reference.axes(), positions.axes(), positions.size(), displacements.data());
+        stale = std::any_of(displacements.begin(), displacements.end(), [this](double d)
+        { return d > skin / 2; });
+    }
+
+    if (!stale)
+        return;
+
+    lm::main()->info("building neighbor lists (skin: {})...", skin);
+
+    reference = std::move(positions);
+    rings = ring_count;
+    ionic_groups = ionic_group_count;
+    for (auto& [family, list]: lists)
+        list.stale = true;
+}
+
 std::vector<shared_ptr<bond::hydrogen const>> filter_hbond_realistic(std::vector<shared_ptr<bond::hydrogen const>> input)
 {
     std::vector<shared_ptr<bond::hydrogen const>> output;
@@ -346,10 +890,10 @@ std::vector<shared_ptr<bond::hydrogen const>> filter_hbond_realistic(std::vector
         output.push_back(bond);
     };
 
-    //Order from smallest to largest energy
-    sort(input.begin(), input.end(),
-         [](shared_ptr<bond::hydrogen const> const& a, shared_ptr<bond::hydrogen const> const& b)
-         { return a->get_energy() < b->get_energy(); });
+    //Order from smallest to largest energy (ties keep the order of the search)
+    std::stable_sort(input.begin(), input.end(),
+                     [](shared_ptr<bond::hydrogen const> const& a, shared_ptr<bond::hydrogen const> const& b)
+                     { return a->get_energy() < b->get_energy(); });
 
     //Add as many hydrogen bonds as possible
     for (const auto& i: input)
@@ -361,26 +905,6 @@ std::vector<shared_ptr<bond::hydrogen const>> filter_hbond_realistic(std::vector
     return output;
 }
 
-template<typename Bond>
-vector<shared_ptr<Bond const>> remove_duplicates(vector<shared_ptr<Bond const>> const& unfiltered)
-{
-    vector<shared_ptr<Bond const>> results;
-    results.reserve(unfiltered.size());
-
-    set<string> unique_ids;
-    for (auto const& b: unfiltered)
-    {
-        auto const bond_id = b->get_id();
-        if (unique_ids.find(bond_id) == unique_ids.end())
-        {
-            unique_ids.insert(bond_id);
-            results.push_back(b);
-        }
-    }
-
-    return results;
-}
-
 template<typename Bond>
 vector<shared_ptr<Bond const>> filter_best(vector<shared_ptr<Bond const>> const& unfiltered)
 {
@@ -407,7 +931,75 @@ void append(vector<shared_ptr<bond::base const>>& dst, vector<shared_ptr<Bond co
 { dst.insert(dst.end(), src.begin(), src.end()); }
 
 rin::graph rin::maker::operator()(parameters const& params) const
+{ return run(params, nullptr); }
+
+rin::graph rin::maker::operator()(parameters const& params, neighbor_lists& lists) const
+{ return run(params, &lists); }
+
+rin::graph rin::maker::run(parameters const& params, neighbor_lists* lists) const
 {
+    // every bond of this run comes from here, and it is released at once at its end (with the graph built)
+    std::pmr::monotonic_buffer_resource arena;
+
+    if (lists != nullptr)
+        lists->pimpl->refresh(pimpl->atoms, pimpl->rings.size(), pimpl->ionic_groups.size());
+
+    // the neighbor list of a family of bonds, if any
+    auto const list = [lists](string const& family) -> pair_list*
+    { return lists == nullptr ? nullptr : &lists->pimpl->lists[family]; };
+
+    double const skin = lists == nullptr ? 0 : lists->pimpl->skin;
+
+    // the indices of the model without neighbor lists, the ones kept across the frames by the lists otherwise
+    index_getter const index_of = [this, lists](index_slot slot) -> spatial_index<entity_id> const&
+    {
+        return lists == nullptr
+               ? pimpl->index(slot)
+               : lists->pimpl->index(pimpl->specs[static_cast<size_t>(slot)], slot);
+    };
+
+    // the indices of the searches that are going to be run (all of them, without neighbor lists) are built
+    // concurrently, before the searches; the futures wait for their task when destroyed, even if one throws
+    {
+        struct planned_search
+        {
+            string family;
+            double dist;
+            vector<index_slot> slots;
+        };
+
+        vector<planned_search> plan;
+        if (params.interaction_type() == parameters::interaction_type_t::NONCOVALENT_BONDS)
+        {
+            plan = {
+                {"hydrogen", params.query_dist_hbond(), {index_slot::HACCEPTOR, index_slot::HDONOR}},
+                {"vdw", params.query_dist_vdw(), {index_slot::VDW}},
+                {"ionic", params.query_dist_ionic(), {index_slot::NEGATIVE_ION, index_slot::POSITIVE_ION}},
+                {"pication", params.query_dist_pica(), {index_slot::CATION, index_slot::PICATION_RING}},
+                {"pipistack", params.query_dist_pipi(), {index_slot::RING}},
+                {"hydrophobic", cfg::params::query_dist_hydrophobic, {index_slot::ALPHA_CARBON}}};
+        }
+        else
+        {
+            auto const slot = params.cmap_type() == rin::parameters::contact_map_type_t::ALPHA
+                              ? index_slot::ALPHA_CARBON
+                              : index_slot::BETA_CARBON;
+            plan = {{"contact", params.query_dist_cmap(), {slot}}};
+        }
+
+        set<index_slot> slots;
+        for (auto const& search: plan)
+            if (needs_search(list(search.family), search.dist))
+                slots.insert(search.slots.begin(), search.slots.end());
+
+        vector<std::future<void>> builds;
+        for (auto slot: slots)
+            builds.push_back(std::async(std::launch::async, [&index_of, slot] { index_of(slot); }));
+
+        for (auto& build: builds)
+            build.get();
+    }
+
     vector<shared_ptr<bond::base const>> results;
     switch (params.interaction_type())
     {
@@ -415,38 +1007,61 @@ rin::graph rin::maker::operator()(parameters const& params) const
     {
         lm::main()->info("finding all bonds...");
         auto hydrogen_bonds = find_bonds<bond::hydrogen>(
-                pimpl->hacceptor_vector,
-                pimpl->hdonor_tree,
+                pimpl->atoms,
+                pimpl->atoms,
+                joining("hydrogen", index_of, index_slot::HACCEPTOR, index_slot::HDONOR, pimpl->box),
                 params.query_dist_hbond(),
-                params);
+                params,
+                pimpl->wraps,
+                list("hydrogen"),
+                skin,
+                &arena);
         if (params.hbond_realistic())
             hydrogen_bonds = filter_hbond_realistic(hydrogen_bonds);
 
-        auto const vdw_bonds = remove_duplicates(
-                find_bonds<bond::vdw>(
-                        pimpl->vdw_vector,
-                        pimpl->vdw_tree,
-                        params.query_dist_vdw(),
-                        params));
+        auto const vdw_bonds = find_bonds<bond::vdw>(
+                pimpl->atoms,
+                pimpl->atoms,
+                self_joining("vdw", index_of, index_slot::VDW, pimpl->box),
+                params.query_dist_vdw(),
+                params,
+                pimpl->wraps,
+                list("vdw"),
+                skin,
+                &arena);
 
         auto const ionic_bonds = find_bonds<bond::ionic>(
-                pimpl->negative_ion_vector,
-                pimpl->positive_ion_tree,
+                pimpl->ionic_groups,
+                pimpl->ionic_groups,
+                joining("ionic", index_of, index_slot::NEGATIVE_ION, index_slot::POSITIVE_ION, pimpl->box),
                 params.query_dist_ionic(),
-                params);
+                params,
+                pimpl->wraps,
+                list("ionic"),
+                skin,
+                &arena);
 
         auto const pication_bonds = find_bonds<bond::pication>(
-                pimpl->cation_vector,
-                pimpl->pication_ring_tree,
+                pimpl->atoms,
+                pimpl->rings,
+                joining("pication", index_of, index_slot::CATION, index_slot::PICATION_RING, pimpl->box),
                 params.query_dist_pica(),
-                params);
-
-        auto const pipistack_bonds = remove_duplicates(
-                find_bonds<bond::pipistack>(
-                        pimpl->ring_vector,
-                        pimpl->ring_tree,
-                        params.query_dist_pipi(),
-                        params));
+                params,
+                pimpl->wraps,
+                list("pication"),
+                skin,
+                &arena);
+
+        auto const pipistack_bonds = find_bonds<bond::pipistack>(
+                pimpl->rings,
+                pimpl->rings,
+                self_joining("pipistack", index_of, index_slot::RING, pimpl->box),
+                params.query_dist_pipi(),
+                params,
+                pimpl->wraps,
+                list("pipistack"),
+                skin,
+                &arena);
 
         switch (params.network_policy())
         {
@@ -481,35 +1096,54 @@ rin::graph rin::maker::operator()(parameters const& params) const
         }
 
         // hydrophobic bonds are just put into the rin _after_ fltering
-        append(results, remove_duplicates(find_bonds<bond::hydrophobic>(
-            pimpl->alpha_carbon_vector,
-            pimpl->alpha_carbon_tree,
-            7.5,
-            params
-        )));
+        append(results, find_bonds<bond::hydrophobic>(
+            pimpl->atoms,
+            pimpl->atoms,
+            self_joining("hydrophobic", index_of, index_slot::ALPHA_CARBON, pimpl->box),
+            cfg::params::query_dist_hydrophobic,
+            params,
+            pimpl->wraps,
+            list("hydrophobic"),
+            skin,
+            &arena
+        ));
         break;
     }
 
     case parameters::interaction_type_t::CONTACT_MAP:
     {
         lm::main()->info("generating contact map...");
+
+        // contact maps ignore periodic boundary conditions
+        optional<geom::lattice> const no_box{};
+
         vector<shared_ptr<bond::contact const>> generic_bonds{};
         switch (params.cmap_type())
         {
         case rin::parameters::contact_map_type_t::ALPHA:
             generic_bonds = find_bonds<bond::contact>(
-                    pimpl->alpha_carbon_vector,
-                    pimpl->alpha_carbon_tree,
+                    pimpl->atoms,
+                    pimpl->atoms,
+                    self_joining("contact", index_of, index_slot::ALPHA_CARBON, no_box),
                     params.query_dist_cmap(),
-                    params);
+                    params,
+                    pimpl->wraps,
+                    list("contact"),
+                    skin,
+                    &arena);
             break;
 
         case rin::parameters::contact_map_type_t::BETA:
             generic_bonds = find_bonds<bond::contact>(
-                    pimpl->beta_carbon_vector,
-                    pimpl->beta_carbon_tree,
+                    pimpl->atoms,
+                    pimpl->atoms,
+                    self_joining("contact", index_of, index_slot::BETA_CARBON, no_box),
                     params.query_dist_cmap(),
-                    params);
+                    params,
+                    pimpl->wraps,
+                    list("contact"),
+                    skin,
+                    &arena);
             break;
         }
 
@@ -59,6 +59,45 @@ string to_string(rin::parameters::illformed_policy_t illformed_policy)
     return ret;
 }
 
+string to_string(rin::parameters::spatial_index_t spatial_index)
+{
+    string ret{};
+    switch (spatial_index)
+    {
+    case rin::parameters::spatial_index_t::KDTREE:
+        ret = "\"kdtree\"";
+        break;
+    case rin::parameters::spatial_index_t::CELL_GRID:
+        ret = "\"grid\"";
+        break;
+    case rin::parameters::spatial_index_t::BRUTE_FORCE:
+        ret = "\"brute\"";
+        break;
+    case rin::parameters::spatial_index_t::AUTO:
+        ret = "\"auto\"";
+        break;
+    }
+    return ret;
+}
+
+string to_string(rin::parameters::precision_t precision)
+{
+    string ret{};
+    switch (precision)
+    {
+    case rin::parameters::precision_t::DOUBLE:
+        ret = "\"double\"";
+        break;
+    case rin::parameters::precision_t::SINGLE:
+        ret = "\"single\"";
+        break;
+    case rin::parameters::precision_t::VALIDATE:
+        ret = "\"validate\"";
+        break;
+    }
+    return ret;
+}
+
 string rin::parameters::serialize_rin() const
 {
     std::ostringstream os;
@@ -106,7 +145,11 @@ string rin::parameters::pretty() const
     strs << "\"--no-hydrogen\": " << (no_hydrogen() ? "true" : "false") << ", "
          << "\"--keep-water\": " << (skip_water() ? "false" : "true") << ", "
          << "\"--sequence-separation\": " << sequence_separation() << ", "
-         << "\"--illformed\": " << to_string(illformed_policy()) << ", ";
+         << "\"--illformed\": " << to_string(illformed_policy()) << ", "
+         << "\"--spatial-index\": " << to_string(spatial_index()) << ", "
+         << "\"--pbc\": " << (periodic() ? "true" : "false") << ", "
+         << "\"--verlet-skin\": " << verlet_skin() << ", "
+         << "\"--precision\": " << to_string(precision()) << ", ";
 
     switch (interaction_type())
     {
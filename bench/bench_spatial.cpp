@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+#include "spatial/brute_force.h"
+#include "spatial/cell_grid.h"
+#include "spatial/kdpoint.h"
+#include "spatial/kdtree.h"
+
+/*
+ * Micro-benchmark of the spatial indices: build time, memory footprint and query throughput
+ * over protein-like point clouds, at the query distances of cfg::params.
+ */
+
+namespace
+{
+// every allocation of the process is accounted here (see operator new below)
+std::atomic<size_t> live_bytes{0};
+std::atomic<size_t> peak_bytes{0};
+
+// the size of each block is stored in front of it, for operator delete
+constexpr size_t header_size = alignof(std::max_align_t);
+
+// results of the searches end up here, so that they are not optimized away
+volatile size_t sink = 0;
+}
+
+void* operator new(size_t size)
+{
+    auto* block = static_cast<char*>(std::malloc(size + header_size));
+    if (block == nullptr)
+        throw std::bad_alloc();
+
+    std::memcpy(block, &size, sizeof(size));
+
+    auto const live = live_bytes += size;
+    auto peak = peak_bytes.load();
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live))
+    {}
+
+    return block + header_size;
+}
+
+void operator delete(void* p) noexcept
+{
+    if (p == nullptr)
+        return;
+
+    auto* block = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(p) - header_size);
+    size_t size;
+    std::memcpy(&size, block, sizeof(size));
+    live_bytes -= size;
+    std::free(block);
+}
+
+void operator delete(void* p, size_t) noexcept
+{ operator delete(p); }
+
+namespace
+{
+using position = std::array<double, 3>;
+using clock_type = std::chrono::steady_clock;
+
+class probe : public kdpoint<3>
+{
+public:
+    explicit probe(position const& p) : kdpoint<3>(p)
+    {}
+};
+
+/**
+ * Protein-like point cloud of n atoms: residues of atoms_per_residue atoms, normally scattered around centres
+ * that fill a cube at the atom density of a folded protein (hydrogens included).
+ */
+std::vector<position> make_cloud(size_t n, std::mt19937_64& rng)
+{
+    constexpr double atom_density = 0.1; // atoms per cubic ångström
+    constexpr size_t atoms_per_residue = 16;
+    constexpr double residue_sd = 1.2;
+
+    double const spacing = std::cbrt(atoms_per_residue / atom_density);
+    size_t const residues = (n + atoms_per_residue - 1) / atoms_per_residue;
+    auto const side = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(residues))));
+
+    std::normal_distribution<double> scatter{0, residue_sd};
+
+    std::vector<position> cloud;
+    cloud.reserve(n);
+    for (size_t r = 0; cloud.size() < n; ++r)
+    {
+        position const centre{
+            spacing * static_cast<double>(r % side),
+            spacing * static_cast<double>(r / side % side),
+            spacing * static_cast<double>(r / side / side)};
+
+        for (size_t a = 0; a < atoms_per_residue && cloud.size() < n; ++a)
+            cloud.push_back({centre[0] + scatter(rng), centre[1] + scatter(rng), centre[2] + scatter(rng)});
+    }
+
+    return cloud;
+}
+
+struct options
+{
+    size_t min_points = 1000;
+    size_t max_points = 10'000'000;
+    size_t queries = 10'000;
+    size_t brute_force_max_points = 10'000;
+    double min_seconds = 0.2;
+    bool csv = false;
+    std::vector<std::string> indices;
+
+    [[nodiscard]]
+    bool selected(std::string const& name) const
+    { return indices.empty() || std::find(indices.begin(), indices.end(), name) != indices.end(); }
+};
+
+struct workload
+{
+    std::vector<position> const& cloud;
+    std::vector<uint32_t> const& ids;
+    std::vector<position> const& queries;
+};
+
+struct cutoff
+{
+    char const* name;
+    double distance;
+};
+
+/**
+ * Runs task over and over for at least min_seconds, and returns the mean time of one run.
+ */
+template<typename Task>
+double seconds_per_run(Task&& task, double min_seconds)
+{
+    size_t runs = 0;
+    auto const start = clock_type::now();
+    std::chrono::duration<double> elapsed{};
+    do
+    {
+        task();
+        ++runs;
+        elapsed = clock_type::now() - start;
+    }
+    while (elapsed.count() < min_seconds);
+
+    return elapsed.count() / static_cast<double>(runs);
+}
+
+void print_header(options const& opts)
+{
+    if (opts.csv)
+        std::printf("index,points,cutoff,distance,build_ms,memory_mb,build_peak_mb,pairs,join_mpairs_s,queries_k_s\n");
+    else
+        std::printf(
+            "%-16s %10s %-10s %6s %10s %10s %10s %12s %12s %12s\n",
+            "index", "points", "cutoff", "dist", "build ms", "mem MB", "peak MB", "pairs", "Mpairs/s", "kqueries/s");
+}
+
+/**
+ * Benchmarks one kind of index over one cloud, at each cutoff.
+ * <br/>
+ * make(positions, ids, distance) builds the index to be searched at distance (cell grids are tuned for it):
+ * the index must provide the range_search(kdpoint<3>, double, vector<size_t>&) and for_each_pair_within(double,
+ * visitor) of kdtree and cell_grid, so that any alternative can be compared by adding one line to main.
+ */
+template<typename Make>
+void run(
+    std::string const& name, Make&& make, workload const& load, std::vector<cutoff> const& cutoffs,
+    options const& opts)
+{
+    constexpr double mb = 1024.0 * 1024.0;
+
+    for (auto const& c: cutoffs)
+    {
+        // memory is measured on a build of its own, so that the timed ones do not overlap
+        size_t const before = live_bytes;
+        peak_bytes = before;
+        auto index = make(load.cloud, load.ids, c.distance);
+        double const memory = static_cast<double>(live_bytes - before) / mb;
+        double const build_peak = static_cast<double>(peak_bytes - before) / mb;
+
+        double const build = seconds_per_run([&] { index = make(load.cloud, load.ids, c.distance); }, opts.min_seconds);
+
+        size_t pairs = 0;
+        double const join = seconds_per_run(
+            [&]
+            {
+                pairs = 0;
+                index.for_each_pair_within(c.distance, [&pairs](uint32_t, uint32_t)
+                { ++pairs; });
+            },
+            opts.min_seconds);
+
+        std::vector<size_t> neighbors;
+        size_t found = 0;
+        double const query = seconds_per_run(
+            [&]
+            {
+                for (auto const& q: load.queries)
+                {
+                    index.range_search(probe{q}, c.distance, neighbors);
+                    found += neighbors.size();
+                }
+            },
+            opts.min_seconds);
+
+        sink = sink + found + pairs;
+
+        double const query_throughput = static_cast<double>(load.queries.size()) / query / 1e3;
+
+        if (opts.csv)
+            std::printf(
+                "%s,%zu,%s,%.2f,%.3f,%.3f,%.3f,%zu,%.3f,%.3f\n",
+                name.c_str(), load.cloud.size(), c.name, c.distance, build * 1e3, memory, build_peak, pairs,
+                static_cast<double>(pairs) / join / 1e6, query_throughput);
+        else
+            std::printf(
+                "%-16s %10zu %-10s %6.2f %10.3f %10.3f %10.3f %12zu %12.3f %12.3f\n",
+                name.c_str(), load.cloud.size(), c.name, c.distance, build * 1e3, memory, build_peak, pairs,
+                static_cast<double>(pairs) / join / 1e6, query_throughput);
+
+        std::fflush(stdout);
+    }
+}
+
+void usage(char const* program)
+{
+    std::cout
+        << "usage: " << program << " [options]\n"
+        << "  --min-points N       smallest cloud (default 1000)\n"
+        << "  --max-points N       largest cloud (default 10000000); sizes grow tenfold\n"
+        << "  --queries N          range queries per cutoff (default 10000)\n"
+        << "  --brute-force-max N  largest cloud for brute-force (default 10000)\n"
+        << "  --seconds S          minimum time of each measurement (default 0.2)\n"
+        << "  --index NAME         only benchmark this index (repeatable): "
+        << "kdtree, kdtree-float, cell-grid, cell-grid-float, brute-force, brute-force-float\n"
+        << "  --csv                comma separated output\n";
+}
+
+options parse(int argc, char const* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const arg = argv[i];
+        auto const value = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--min-points")
+            opts.min_points = std::stoull(value());
+        else if (arg == "--max-points")
+            opts.max_points = std::stoull(value());
+        else if (arg == "--queries")
+            opts.queries = std::stoull(value());
+        else if (arg == "--brute-force-max")
+            opts.brute_force_max_points = std::stoull(value());
+        else if (arg == "--seconds")
+            opts.min_seconds = std::stod(value());
+        else if (arg == "--index")
+            opts.indices.push_back(value());
+        else if (arg == "--csv")
+            opts.csv = true;
+        else
+            throw std::invalid_argument("unknown option " + arg);
+    }
+
+    return opts;
+}
+}
+
+int main(int argc, char const* argv[])
+{
+    options opts;
+    try
+    {
+        if (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+
+        opts = parse(argc, argv);
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the query distances rin::maker searches at, with the default parameters
+    std::vector<cutoff> const cutoffs{
+        {"hbond", cfg::params::query_dist_hbond},
+        {"ionic", cfg::params::query_dist_ionic},
+        {"pication", cfg::params::query_dist_pica},
+        {"cmap", cfg::params::query_dist_alpha},
+        {"pipistack", cfg::params::query_dist_pipi},
+        {"vdw", cfg::params::surface_dist_vdw + 2 * cfg::params::max_vdw_radius}};
+
+    auto const make_kdtree = [](auto real)
+    {
+        using Real = decltype(real);
+        return [](std::vector<position> const& positions, std::vector<uint32_t> const& ids, double)
+        {
+            return kdtree<uint32_t, 3, Real>(
+                positions, ids, kdtree<uint32_t, 3, Real>::default_bucket_size, cfg::params::parallel_build_threshold);
+        };
+    };
+
+    auto const make_cell_grid = [](auto real)
+    {
+        using Real = decltype(real);
+        return [](std::vector<position> const& positions, std::vector<uint32_t> const& ids, double distance)
+        { return cell_grid<uint32_t, Real>(positions, ids, distance); };
+    };
+
+    auto const make_brute_force = [](auto real)
+    {
+        using Real = decltype(real);
+        return [](std::vector<position> const& positions, std::vector<uint32_t> const& ids, double)
+        { return brute_force<uint32_t, Real>(positions, ids); };
+    };
+
+    print_header(opts);
+
+    std::mt19937_64 rng{20220101};
+    for (size_t n = opts.min_points; n <= opts.max_points; n *= 10)
+    {
+        auto const cloud = make_cloud(n, rng);
+
+        std::vector<uint32_t> ids(cloud.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            ids[i] = static_cast<uint32_t>(i);
+
+        // queries are centred on atoms of the cloud, as in rin::maker
+        std::uniform_int_distribution<size_t> pick{0, cloud.size() - 1};
+        std::vector<position> queries(std::min(opts.queries, cloud.size()));
+        for (auto& q: queries)
+            q = cloud[pick(rng)];
+
+        workload const load{cloud, ids, queries};
+
+        if (opts.selected("kdtree"))
+            run("kdtree", make_kdtree(double{}), load, cutoffs, opts);
+        if (opts.selected("kdtree-float"))
+            run("kdtree-float", make_kdtree(float{}), load, cutoffs, opts);
+        if (opts.selected("cell-grid"))
+            run("cell-grid", make_cell_grid(double{}), load, cutoffs, opts);
+        if (opts.selected("cell-grid-float"))
+            run("cell-grid-float", make_cell_grid(float{}), load, cutoffs, opts);
+        if (opts.selected("brute-force") && n <= opts.brute_force_max_points)
+            run("brute-force", make_brute_force(double{}), load, cutoffs, opts);
+        if (opts.selected("brute-force-float") && n <= opts.brute_force_max_points)
+            run("brute-force-float", make_brute_force(float{}), load, cutoffs, opts);
+    }
+
+    return 0;
+}
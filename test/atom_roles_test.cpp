@@ -0,0 +1,125 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "atom_roles.h"
+
+using namespace std;
+
+namespace
+{
+// the string comparisons of chemical_entity::atom that the table replaces
+bool is_hydrogen_donor(string const& res_name, string const& name)
+{
+	return (res_name == "ARG" && (name == "NH1" || name == "NH2" || name == "NE"))
+		|| (res_name == "ASN" && name == "ND2")
+		|| (res_name == "GLN" && name == "NE2")
+		|| (res_name == "HIS" && (name == "NE2" || name == "ND1"))
+		|| (res_name == "LYS" && name == "NZ")
+		|| (res_name == "SER" && name == "OG")
+		|| (res_name == "THR" && name == "OG1")
+		|| (res_name == "TRP" && name == "NE1")
+		|| (res_name == "TYR" && name == "OH")
+		|| name == "NH"
+		|| name == "N";
+}
+
+int how_many_hydrogen_can_donate(string const& res_name, string const& n)
+{
+	if (!is_hydrogen_donor(res_name, n))
+		return 0;
+	if ((res_name == "ARG" && (n == "NH1" || n == "NH2")) || (res_name == "ASN" && n == "ND2") || (res_name == "GLN" && n == "NE2"))
+		return 2;
+	if (res_name == "LYS" && n == "NZ")
+		return 3;
+	return 1;
+}
+
+bool is_hydrogen_acceptor(string const& res_name, string const& name)
+{
+	return (res_name == "ASN" && name == "OD1")
+		|| (res_name == "ASP" && (name == "OD1" || name == "OD2"))
+		|| (res_name == "GLN" && name == "OE1")
+		|| (res_name == "GLU" && (name == "OE1" || name == "OE2"))
+		|| (res_name == "HIS" && (name == "ND1" || name == "NE2"))
+		|| (res_name == "SER" && name == "OG")
+		|| (res_name == "THR" && name == "OG1")
+		|| (res_name == "TYR" && name == "OH")
+		|| name == "O";
+}
+
+int how_many_hydrogen_can_accept(string const& res_name, string const& n)
+{
+	if (!is_hydrogen_acceptor(res_name, n))
+		return 0;
+	if ((res_name == "ASN" && n == "OD1") || (res_name == "ASP" && (n == "OD1" || n == "OD2")) ||
+		(res_name == "GLN" && n == "OE1") || (res_name == "GLU" && (n == "OE1" || n == "OE2")) ||
+		(res_name == "SER" && n == "OG") || (res_name == "THR" && n == "OG1"))
+		return 2;
+	return 1;
+}
+
+bool is_cation(string const& res_name, string const& name)
+{
+	return (res_name == "LYS" && name == "NZ") || (res_name == "ARG" && name == "NH2") || (res_name == "HIS" && name == "ND1");
+}
+
+bool in_positive_ionic_group(string const& res_name, string const& name)
+{
+	if (res_name == "HIS")
+		return name == "CG" || name == "CD2" || name == "CE1" || name == "ND1" || name == "NE2";
+	if (res_name == "ARG")
+		return name == "CZ" || name == "NH2" || name == "NH1" || name == "NE";
+	if (res_name == "LYS")
+		return name == "NZ";
+	return false;
+}
+
+bool in_negative_ionic_group(string const& res_name, string const& name)
+{
+	if (res_name == "GLU")
+		return name == "CD" || name == "OE1" || name == "OE2";
+	if (res_name == "ASP")
+		return name == "CG" || name == "OD1" || name == "OD2";
+	return false;
+}
+
+bool is_main_chain(string const& name)
+{
+	return name == "C" || name == "O" || name == "H" || name == "HA" || name == "N";
+}
+}
+
+TEST(AtomRolesTest, SameAsStringComparisons) {
+	vector<string> const residues{
+		"ALA", "ARG", "ASN", "ASP", "CYS", "GLN", "GLU", "GLY", "HIS", "ILE", "LEU", "LYS", "MET", "PHE", "PRO",
+		"SER", "THR", "TRP", "TYR", "VAL", "HOH", "", "NONSTD" };
+	vector<string> const atoms{
+		"N", "CA", "C", "O", "H", "HA", "NH", "CB", "CG", "CD", "CD1", "CD2", "CE", "CE1", "CE2", "CE3", "CZ", "CZ2",
+		"CZ3", "CH2", "NE", "NE1", "NE2", "ND1", "ND2", "NH1", "NH2", "NZ", "OD1", "OD2", "OE1", "OE2", "OG", "OG1",
+		"OH", "SD", "SG", "OXT", "HH11", "", "LONGNAME" };
+
+	for (auto const& res : residues)
+	{
+		for (auto const& name : atoms)
+		{
+			auto const roles = atom_roles::of(res, name);
+			EXPECT_EQ(roles.has(atom_roles::HYDROGEN_DONOR), is_hydrogen_donor(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.has(atom_roles::HYDROGEN_ACCEPTOR), is_hydrogen_acceptor(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.donated, how_many_hydrogen_can_donate(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.accepted, how_many_hydrogen_can_accept(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.has(atom_roles::CATION), is_cation(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.has(atom_roles::POSITIVE_IONIC_GROUP), in_positive_ionic_group(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.has(atom_roles::NEGATIVE_IONIC_GROUP), in_negative_ionic_group(res, name)) << res << " " << name;
+			EXPECT_EQ(roles.has(atom_roles::MAIN_CHAIN), is_main_chain(name)) << res << " " << name;
+		}
+	}
+}
+
+TEST(AtomRolesTest, ComputedAtCompileTime) {
+	static_assert(atom_roles::of("LYS", "NZ").donated == 3);
+	static_assert(atom_roles::of("ARG", "NH2").has(atom_roles::CATION));
+	static_assert(atom_roles::of("GLY", "N").has(atom_roles::MAIN_CHAIN));
+	static_assert(atom_roles::of("GLY", "CA").roles == 0);
+	SUCCEED();
+}
@@ -55,7 +55,8 @@ public:
     std::unordered_map<std::string, node> nodes;
 
 public:
-    explicit Result(rin::maker const& rm, rin::parameters const& params) : rin_graph(rm(params))
+    explicit Result(rin::maker const& rm, rin::parameters const& params, rin::neighbor_lists* lists = nullptr) :
+        rin_graph(lists == nullptr ? rm(params) : rm(params, *lists))
     {
         edges = rin_graph.get_edges();
         nodes = rin_graph.get_nodes();
@@ -89,17 +90,23 @@ protected:
 
     static void TearDownTestSuite() { }
 
-    Result SetUp(const string& filename, const vector<const char*>& additionalParameters = {})
+    Result SetUp(
+        const string& filename,
+        const vector<const char*>& additionalParameters = {},
+        const vector<const char*>& globalParameters = {},
+        rin::neighbor_lists* lists = nullptr)
     {
         string exePath = running_path.string();
         string pdbPath = (running_folder / test_case_folder / filename).string();
 
-        // RINmaker -i filename -o dummy --illformed=kall rin
-        vector<const char*> mandatoryParameters = { exePath.c_str(), "-i", pdbPath.c_str(), "-o dummy", "--illformed=kall", "rin"};
+        // RINmaker -i filename -o dummy --illformed=kall [global parameters] rin [additional parameters]
+        vector<const char*> mandatoryParameters = { exePath.c_str(), "-i", pdbPath.c_str(), "-o dummy", "--illformed=kall"};
 
         vector<const char*> parameters;
-        parameters.reserve(mandatoryParameters.size() + additionalParameters.size());
+        parameters.reserve(mandatoryParameters.size() + globalParameters.size() + 1 + additionalParameters.size());
         parameters.insert(parameters.end(), mandatoryParameters.begin(), mandatoryParameters.end());
+        parameters.insert(parameters.end(), globalParameters.begin(), globalParameters.end());
+        parameters.push_back("rin");
         parameters.insert(parameters.end(), additionalParameters.begin(), additionalParameters.end());
 
         auto maybe_args = read_args(static_cast<int>(parameters.size()), parameters.data());
@@ -107,7 +114,7 @@ protected:
         auto const parsed_args = maybe_args.value();
         auto protein_structure = gemmi::read_pdb_file(parsed_args.input().string());
         // again, won't throw because tests are handcrafted to have 1 model each
-        return Result(rin::maker{protein_structure.first_model(), protein_structure, parsed_args}, parsed_args);
+        return Result(rin::maker{protein_structure.first_model(), protein_structure, parsed_args}, parsed_args, lists);
     }
 
     void TearDown() override { }
@@ -567,6 +574,34 @@ TEST_F(BlackBoxTest, PiPi6) {
     }
 }
 
+TEST_F(BlackBoxTest, PiPi7) {
+    // the same rings of pipi5, but the first one has two alternate locations (12 atoms)
+    auto e1 = [](const edge &e) {
+        return interaction_name(e) == "PIPISTACK" && source(e) == "PHE" && target(e) == "PHE" &&
+               compare_distance(e, 1) && compare_angle(e, 0);
+    };
+
+    {
+        Result r = SetUp("pipi/pipi7.pdb");
+
+        // no residue is skipped
+        EXPECT_EQ(r.nodes.size(), 2);
+        EXPECT_EQ(r.count_edges(isPipiFunc), 1);
+        EXPECT_TRUE(r.contain_edge(e1));
+    }
+}
+
+TEST_F(BlackBoxTest, PiPi8) {
+    // the rings of pipi5, in two residues with the same id (0:1:_:PHE, told apart by an insertion code only)
+    {
+        Result r = SetUp("pipi/pipi8.pdb");
+
+        // nodes are by id; the two aminoacids are different ones, but there is no sequence separation between them
+        EXPECT_EQ(r.nodes.size(), 1);
+        EXPECT_EQ(r.count_edges(isPipiFunc), 0);
+    }
+}
+
 #pragma endregion
 
 #pragma region VDW
@@ -773,4 +808,54 @@ TEST_F(BlackBoxTest, Picat5) {
     }
 }
 
+#pragma endregion
+
+#pragma region SpatialIndex
+
+TEST_F(BlackBoxTest, SameNetworkWithAnySpatialIndex) {
+    for (auto const& filename : {"hbond/hbond5.pdb", "ionion/ionion3.pdb", "pipi/pipi6.pdb", "vdw/vdw8.pdb", "picat/picat2.pdb"})
+    {
+        Result kd = SetUp(filename, {}, {"--spatial-index", "kdtree"});
+        for (auto const& index : {"grid", "brute", "auto"})
+        {
+            Result other = SetUp(filename, {}, {"--spatial-index", index});
+
+            EXPECT_EQ(other.edges.size(), kd.edges.size()) << filename << " " << index;
+            for (auto const& is_type : vector<function<bool(const edge&)>>{isIonicFunc, isHbondFunc, isPipiFunc, isVdwFunc, isPicatFunc})
+                EXPECT_EQ(other.count_edges(is_type), kd.count_edges(is_type)) << filename << " " << index;
+        }
+    }
+}
+
+TEST_F(BlackBoxTest, SameNetworkWithNeighborLists) {
+    for (auto const& filename : {"hbond/hbond5.pdb", "ionion/ionion3.pdb", "pipi/pipi6.pdb", "vdw/vdw8.pdb", "picat/picat2.pdb"})
+    {
+        Result direct = SetUp(filename);
+
+        // the first frame builds the lists, the second one only checks their candidates again
+        rin::neighbor_lists lists(2.0);
+        for (int frame = 0; frame < 2; ++frame)
+        {
+            Result listed = SetUp(filename, {}, {}, &lists);
+
+            EXPECT_EQ(listed.edges.size(), direct.edges.size()) << filename;
+            for (auto const& is_type : vector<function<bool(const edge&)>>{isIonicFunc, isHbondFunc, isPipiFunc, isVdwFunc, isPicatFunc})
+                EXPECT_EQ(listed.count_edges(is_type), direct.count_edges(is_type)) << filename;
+        }
+    }
+}
+
+TEST_F(BlackBoxTest, NoIndexUpdatesWithFreshNeighborLists) {
+    rin::neighbor_lists lists(2.0);
+
+    // the first frame searches every family of bonds, so it builds their indices
+    SetUp("hbond/hbond5.pdb", {}, {}, &lists);
+    auto const updates = lists.index_updates();
+    EXPECT_GT(updates, 0u);
+
+    // nothing has moved: every list is still fresh, and no index is built nor refitted
+    SetUp("hbond/hbond5.pdb", {}, {}, &lists);
+    EXPECT_EQ(lists.index_updates(), updates);
+}
+
 #pragma endregion
\ No newline at end of file
@@ -0,0 +1,140 @@
+
+#include "mykdpoint.h"
+
+#include "spatial/brute_force.h"
+#include "spatial/search_cost.h"
+
+using namespace std;
+typedef brute_force<MyKDPoint<3>> MyBruteForce;
+
+TEST(BruteForceTest, SameResultsAsKDTree) {
+	std::default_random_engine engine(71);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 1000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	kdtree<MyKDPoint<3>, 3> tree(vec);
+	MyBruteForce all(vec);
+	EXPECT_EQ(all.size(), vec.size());
+
+	vector<size_t> from_tree, from_all;
+	for (int i = 0; i < 100; ++i)
+	{
+		MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+		tree.range_search(test, 4.5, from_tree);
+		all.range_search(test, 4.5, from_all);
+		EXPECT_EQ(from_all.size(), from_tree.size());
+		EXPECT_EQ(all.range_search(test, 4.5).size(), from_tree.size());
+	}
+}
+
+TEST(BruteForceTest, JoinsSameAsKDTree) {
+	std::default_random_engine engine(73);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	// more than one tile on each side
+	vector<MyKDPoint<3>> left, right;
+	for (int i = 0; i < 1300; ++i)
+		left.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+	for (int i = 0; i < 700; ++i)
+		right.push_back(MyKDPoint<3>({ coordinate(engine) / 2, coordinate(engine), coordinate(engine) }));
+
+	size_t expected = 0, visited = 0;
+	kdtree<MyKDPoint<3>, 3>(left).for_each_pair_within(4, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++expected; });
+	MyBruteForce(left).for_each_pair_within(4, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+		EXPECT_LT(&a, &b);
+		EXPECT_LE(a.distance(b), 4);
+		++visited;
+	});
+	EXPECT_EQ(visited, expected);
+
+	expected = visited = 0;
+	kdtree<MyKDPoint<3>, 3>(left).for_each_pair_within(
+		kdtree<MyKDPoint<3>, 3>(right), 3.5, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++expected; });
+	MyBruteForce(left).for_each_pair_within(
+		MyBruteForce(right), 3.5, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+			EXPECT_LE(a.distance(b), 3.5);
+			++visited;
+		});
+	EXPECT_EQ(visited, expected);
+}
+
+TEST(BruteForceTest, PeriodicSameAsKDTree) {
+	std::default_random_engine engine(79);
+	std::uniform_real_distribution<double> fraction(0, 1);
+
+	geom::lattice const box{ { { { 20, 0, 0 }, { 5, 18, 0 }, { -4, 3, 16 } } } };
+	double const range = 4;
+
+	vector<MyKDPoint<3>> left, right;
+	for (int i = 0; i < 500; ++i)
+	{
+		double const a = fraction(engine), b = fraction(engine), c = fraction(engine);
+		std::array<double, 3> p{};
+		for (size_t axis = 0; axis < 3; ++axis)
+			p[axis] = a * box.vectors[0][axis] + b * box.vectors[1][axis] + c * box.vectors[2][axis];
+		(i % 2 == 0 ? left : right).push_back(MyKDPoint<3>(p));
+	}
+
+	kdtree<MyKDPoint<3>, 3> const left_tree(left), right_tree(right);
+	MyBruteForce const left_all(left), right_all(right);
+
+	size_t expected = 0, visited = 0;
+	left_tree.for_each_pair_within(range, box, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) { ++expected; });
+	left_all.for_each_pair_within(range, box, [&visited, range](MyKDPoint<3> const& a, MyKDPoint<3> const& b, std::array<double, 3> const& shift) {
+		EXPECT_LE(geom::distance<3>(geom::difference<3>((std::array<double, 3>) a, shift), (std::array<double, 3>) b), range);
+		++visited;
+	});
+	EXPECT_EQ(visited, expected);
+
+	expected = visited = 0;
+	left_tree.for_each_pair_within(right_tree, range, box, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) { ++expected; });
+	left_all.for_each_pair_within(right_all, range, box, [&visited](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) { ++visited; });
+	EXPECT_EQ(visited, expected);
+
+	EXPECT_THROW(
+		left_all.for_each_pair_within(box.min_width(), box, [](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) {}),
+		std::invalid_argument);
+}
+
+TEST(SearchCostTest, BruteForceOnlyForFewPoints) {
+	std::default_random_engine engine(83);
+
+	// protein-like density: 0.1 points per cubic angstrom
+	auto const cloud = [&engine](size_t n) {
+		double const side = std::cbrt(n / 0.1);
+		std::uniform_real_distribution<double> coordinate(0, side);
+
+		vector<std::array<double, 3>> positions;
+		for (size_t i = 0; i < n; ++i)
+			positions.push_back({ coordinate(engine), coordinate(engine), coordinate(engine) });
+		return positions;
+	};
+
+	for (size_t n : { 10, 50 })
+	{
+		auto const positions = cloud(n);
+		vector<uint32_t> ids(n);
+		std::iota(ids.begin(), ids.end(), 0);
+
+		auto const s = search_cost::side::of(positions, ids);
+		EXPECT_EQ(search_cost::self_join(s, 4).best(), search_cost::algorithm::BRUTE_FORCE) << n;
+		EXPECT_EQ(search_cost::join(s, s, 4).best(), search_cost::algorithm::BRUTE_FORCE) << n;
+	}
+
+	for (size_t n : { 10000, 100000 })
+	{
+		auto const positions = cloud(n);
+		vector<uint32_t> ids(n);
+		std::iota(ids.begin(), ids.end(), 0);
+
+		auto const s = search_cost::side::of(positions, ids);
+		EXPECT_NE(search_cost::self_join(s, 4).best(), search_cost::algorithm::BRUTE_FORCE) << n;
+		EXPECT_NE(search_cost::join(s, s, 4).best(), search_cost::algorithm::BRUTE_FORCE) << n;
+	}
+
+	// nothing to search
+	EXPECT_EQ(search_cost::self_join(search_cost::side{}, 0).best(), search_cost::algorithm::BRUTE_FORCE);
+}
@@ -0,0 +1,234 @@
+#include <iterator>
+#include <set>
+
+#include "mykdpoint.h"
+
+#include "spatial/cell_grid.h"
+
+using namespace std;
+typedef cell_grid<MyKDPoint<3>> MyCellGrid;
+
+TEST(CellGridTest, DistanceOnAllQuotas) {
+	vector<MyKDPoint<3>> vec;
+	for (int x = -1; x <= 1; ++x)
+		for (int y = -1; y <= 1; ++y)
+			for (int z = -1; z <= 1; ++z)
+				if (x != 0 || y != 0 || z != 0)
+					vec.push_back(MyKDPoint<3>({ (double)x, (double)y, (double)z }));
+
+	MyCellGrid grid(vec, 1);
+	EXPECT_EQ(grid.size(), 26);
+	EXPECT_EQ(grid.range_search(MyKDPoint<3>({ 0, 0, 0 }), 1).size(), 6);
+	EXPECT_EQ(grid.range_search(MyKDPoint<3>({ 0, 0, 0 }), sqrt(2)).size(), 18);
+	EXPECT_EQ(grid.range_search(MyKDPoint<3>({ 0, 0, 0 }), sqrt(3)).size(), 26);
+
+	// far away from the grid
+	EXPECT_TRUE(grid.range_search(MyKDPoint<3>({ 100, 0, 0 }), 5).empty());
+}
+
+TEST(CellGridTest, SameResultsAsKDTree) {
+	std::default_random_engine engine(7);
+	std::uniform_real_distribution<double> coordinate(-30, 30);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 3000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	kdtree<MyKDPoint<3>, 3> tree(vec);
+	vector<size_t> from_tree, from_grid;
+
+	// the cell size need not match the query distance
+	for (double cell_size : { 2.0, 4.5, 10.0 })
+	{
+		MyCellGrid grid(vec, cell_size);
+		for (int i = 0; i < 100; ++i)
+		{
+			MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+			size_t visited = 0;
+			grid.for_each_in_range(test, 4.5, [&visited](MyKDPoint<3> const&) { ++visited; });
+
+			tree.range_search(test, 4.5, from_tree);
+			grid.range_search(test, 4.5, from_grid);
+			EXPECT_EQ(from_grid.size(), from_tree.size());
+			EXPECT_EQ(visited, from_tree.size());
+		}
+	}
+}
+
+TEST(CellGridTest, InvalidCellSize) {
+	vector<MyKDPoint<3>> vec{ MyKDPoint<3>({ 0, 0, 0 }) };
+	EXPECT_THROW(MyCellGrid(vec, 0), std::invalid_argument);
+}
+
+TEST(CellGridTest, SelfJoinSameAsKDTree) {
+	std::default_random_engine engine(13);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 1000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	size_t expected = 0;
+	kdtree<MyKDPoint<3>, 3>(vec).for_each_pair_within(4, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++expected; });
+
+	for (double cell_size : { 1.5, 4.0, 9.0 })
+	{
+		size_t visited = 0;
+		MyCellGrid(vec, cell_size).for_each_pair_within(4, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+			EXPECT_LT(&a, &b);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected);
+	}
+}
+
+TEST(CellGridTest, JoinSameAsKDTree) {
+	std::default_random_engine engine(19);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	vector<MyKDPoint<3>> left, right;
+	for (int i = 0; i < 800; ++i)
+		left.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+	for (int i = 0; i < 500; ++i)
+		right.push_back(MyKDPoint<3>({ coordinate(engine) / 2, coordinate(engine), coordinate(engine) }));
+
+	size_t expected = 0;
+	kdtree<MyKDPoint<3>, 3>(left).for_each_pair_within(
+		kdtree<MyKDPoint<3>, 3>(right), 3.5, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++expected; });
+
+	// the two grids need not be aligned, nor have the same cell size
+	for (double cell_size : { 1.0, 3.5, 8.0 })
+	{
+		size_t visited = 0;
+		MyCellGrid(left, cell_size).for_each_pair_within(
+			MyCellGrid(right, 3.5), 3.5, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+				EXPECT_LE(a.distance(b), 3.5);
+				++visited;
+			});
+		EXPECT_EQ(visited, expected);
+	}
+}
+
+TEST(CellGridTest, BatchSameAsSingleQueries) {
+	std::default_random_engine engine(29);
+	std::uniform_real_distribution<double> coordinate(-20, 20);
+
+	vector<MyKDPoint<3>> vec, queries;
+	for (int i = 0; i < 2000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+	for (int i = 0; i < 300; ++i)
+		queries.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	MyCellGrid grid(vec, 4);
+	auto const batch = grid.batch_range_search(queries, 4);
+	ASSERT_EQ(batch.size(), queries.size());
+
+	vector<size_t> neighbors;
+	for (size_t q = 0; q < queries.size(); ++q)
+	{
+		grid.range_search(queries[q], 4, neighbors);
+		EXPECT_EQ(batch.count(q), neighbors.size());
+	}
+}
+
+TEST(CellGridTest, IdsIntoSharedPositions) {
+	std::default_random_engine engine(43);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	vector<std::array<double, 3>> positions;
+	vector<MyKDPoint<3>> points;
+	for (int i = 0; i < 2000; ++i)
+	{
+		positions.push_back({ coordinate(engine), coordinate(engine), coordinate(engine) });
+		points.push_back(MyKDPoint<3>(positions.back()));
+	}
+
+	vector<uint32_t> ids(positions.size());
+	std::iota(ids.begin(), ids.end(), 0);
+
+	// the same pairs as the grid of the points themselves
+	size_t expected = 0;
+	MyCellGrid(points, 3).for_each_pair_within(3, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++expected; });
+
+	size_t visited = 0;
+	cell_grid<uint32_t>(positions, ids, 3).for_each_pair_within(3, [&visited, &positions](uint32_t a, uint32_t b) {
+		EXPECT_LE(geom::distance<3>(positions[a], positions[b]), 3);
+		++visited;
+	});
+	EXPECT_EQ(visited, expected);
+}
+
+TEST(CellGridTest, PeriodicSameAsKDTree) {
+	std::default_random_engine engine(47);
+	std::uniform_real_distribution<double> fraction(0, 1);
+
+	geom::lattice const box{ { { { 20, 0, 0 }, { 5, 18, 0 }, { -4, 3, 16 } } } };
+	double const range = 4;
+
+	vector<MyKDPoint<3>> left, right;
+	for (int i = 0; i < 500; ++i)
+	{
+		double const a = fraction(engine), b = fraction(engine), c = fraction(engine);
+		std::array<double, 3> p{};
+		for (size_t axis = 0; axis < 3; ++axis)
+			p[axis] = a * box.vectors[0][axis] + b * box.vectors[1][axis] + c * box.vectors[2][axis];
+		(i % 2 == 0 ? left : right).push_back(MyKDPoint<3>(p));
+	}
+
+	kdtree<MyKDPoint<3>, 3> const left_tree(left), right_tree(right);
+	MyCellGrid const left_grid(left, range), right_grid(right, range);
+
+	size_t expected = 0, visited = 0;
+	left_tree.for_each_pair_within(range, box, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) { ++expected; });
+	left_grid.for_each_pair_within(range, box, [&visited, range](MyKDPoint<3> const& a, MyKDPoint<3> const& b, std::array<double, 3> const& shift) {
+		EXPECT_LE(geom::distance<3>(geom::difference<3>((std::array<double, 3>) a, shift), (std::array<double, 3>) b), range);
+		++visited;
+	});
+	EXPECT_EQ(visited, expected);
+
+	expected = visited = 0;
+	left_tree.for_each_pair_within(right_tree, range, box, [&expected](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) { ++expected; });
+	left_grid.for_each_pair_within(right_grid, range, box, [&visited, range](MyKDPoint<3> const& a, MyKDPoint<3> const& b, std::array<double, 3> const& shift) {
+		EXPECT_LE(geom::distance<3>(geom::difference<3>((std::array<double, 3>) a, shift), (std::array<double, 3>) b), range);
+		++visited;
+	});
+	EXPECT_EQ(visited, expected);
+
+	expected = visited = 0;
+	left_tree.for_each_in_range(right.front(), range, box, [&expected](MyKDPoint<3> const&, std::array<double, 3> const&) { ++expected; });
+	left_grid.for_each_in_range(right.front(), range, box, [&visited](MyKDPoint<3> const&, std::array<double, 3> const&) { ++visited; });
+	EXPECT_EQ(visited, expected);
+
+	EXPECT_THROW(
+		left_grid.for_each_in_range(right.front(), box.min_width(), box, [](MyKDPoint<3> const&, std::array<double, 3> const&) {}),
+		std::invalid_argument);
+}
+
+TEST(CellGridTest, SinglePrecisionSameAsDouble) {
+	std::default_random_engine engine(61);
+	std::uniform_int_distribution<int> milli(-30000, 30000);
+
+	vector<std::array<double, 3>> positions;
+	for (int i = 0; i < 3000; ++i)
+		positions.push_back({ milli(engine) / 1000., milli(engine) / 1000., milli(engine) / 1000. });
+
+	vector<uint32_t> left, right;
+	for (uint32_t id = 0; id < positions.size(); ++id)
+		(id % 3 == 0 ? left : right).push_back(id);
+
+	std::set<std::pair<uint32_t, uint32_t>> exact, single;
+	cell_grid<uint32_t>(positions, left, 4).for_each_pair_within(cell_grid<uint32_t>(positions, right, 4), 4, [&exact](uint32_t a, uint32_t b) {
+		exact.emplace(a, b);
+	});
+	cell_grid<uint32_t, float>(positions, left, 4).for_each_pair_within(cell_grid<uint32_t, float>(positions, right, 4), 4, [&single](uint32_t a, uint32_t b) {
+		single.emplace(a, b);
+	});
+
+	vector<std::pair<uint32_t, uint32_t>> different;
+	std::set_symmetric_difference(exact.begin(), exact.end(), single.begin(), single.end(), std::back_inserter(different));
+	for (auto const& [a, b] : different)
+		EXPECT_NEAR(geom::distance<3>(positions[a], positions[b]), 4, 1e-4);
+
+	EXPECT_LE(different.size(), exact.size() / 1000);
+}
@@ -0,0 +1,127 @@
+
+#include <random>
+#include <gtest/gtest.h>
+
+#include "spatial/geometry.h"
+
+using namespace std;
+
+TEST(GeometryTest, MinSquaredDistanceOfPointBlocks) {
+	std::default_random_engine engine(89);
+	std::uniform_real_distribution<double> coordinate(-10, 10);
+
+	for (int trial = 0; trial < 200; ++trial)
+	{
+		// every size up to the capacity, so that padded lanes are exercised too
+		vector<std::array<double, 3>> a(1 + trial % 6), b(1 + trial / 6 % 6);
+		for (auto& p : a)
+			p = { coordinate(engine), coordinate(engine), coordinate(engine) };
+		for (auto& p : b)
+			p = { coordinate(engine), coordinate(engine), coordinate(engine) };
+
+		double expected = numeric_limits<double>::infinity();
+		for (auto const& p : a)
+			for (auto const& q : b)
+				expected = min(expected, geom::distance<3>(p, q));
+
+		geom::point_block<6> const block_a(a), block_b(b);
+		EXPECT_DOUBLE_EQ(sqrt(geom::min_squared_distance(block_a, block_b)), expected);
+		EXPECT_DOUBLE_EQ(sqrt(geom::min_squared_distance(block_b, block_a)), expected);
+	}
+
+	EXPECT_THROW(geom::point_block<6>(vector<std::array<double, 3>>(7)), std::invalid_argument);
+	EXPECT_THROW(geom::point_block<6>(vector<std::array<double, 3>>{}), std::invalid_argument);
+}
+
+TEST(GeometryTest, AngleLimitsSameAsAngles) {
+	std::default_random_engine engine(97);
+	std::uniform_real_distribution<double> coordinate(-5, 5);
+
+	for (double limit : { -1.0, 0.0, 30.0, 45.0, 60.0, 63.0, 90.0, 120.0, 180.0, 200.0 })
+	{
+		geom::angle_limit const l(limit);
+		for (int trial = 0; trial < 1000; ++trial)
+		{
+			std::array<double, 3> const v{ coordinate(engine), coordinate(engine), coordinate(engine) };
+			std::array<double, 3> const w{ coordinate(engine), coordinate(engine), coordinate(engine) };
+
+			// far enough from the limit not to depend on rounding
+			double const angle = geom::angle<3>(v, w), d_angle = geom::d_angle<3>(v, w);
+			if (std::abs(angle - limit) > 1e-6)
+			{
+				EXPECT_EQ(geom::angle_within<3>(v, w, l), angle <= limit) << limit << " " << angle;
+			}
+			if (std::abs(d_angle - limit) > 1e-6)
+			{
+				EXPECT_EQ(geom::d_angle_within<3>(v, w, l), d_angle <= limit) << limit << " " << d_angle;
+			}
+		}
+	}
+
+	// the angle with a null vector is undefined
+	std::array<double, 3> const zero{}, x{ 1, 0, 0 };
+	EXPECT_FALSE(geom::angle_within<3>(zero, x, geom::angle_limit(180)));
+	EXPECT_FALSE(geom::d_angle_within<3>(x, zero, geom::angle_limit(90)));
+
+	// parallel vectors, whose cosine may round above 1
+	std::array<double, 3> const v{ 0.1, 0.7, -0.3 }, w{ 0.3, 2.1, -0.9 };
+	EXPECT_TRUE(geom::angle_within<3>(v, w, geom::angle_limit(0.5)));
+	EXPECT_TRUE(geom::d_angle_within<3>(v, geom::difference<3>({}, w), geom::angle_limit(0.5)));
+}
+
+TEST(GeometryTest, BatchDistancesSameAsSingleVectors) {
+	std::default_random_engine engine(101);
+	std::uniform_real_distribution<double> coordinate(-10, 10);
+
+	// every remainder of the SIMD lanes, and the empty batch
+	for (size_t n = 0; n <= 13; ++n)
+	{
+		vector<std::array<double, 3>> v(n), w(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			v[i] = { coordinate(engine), coordinate(engine), coordinate(engine) };
+			w[i] = { coordinate(engine), coordinate(engine), coordinate(engine) };
+		}
+
+		geom::point_array<3> const batch_v(v), batch_w(w);
+		ASSERT_EQ(batch_v.size(), n);
+
+		vector<double> between(n);
+		geom::distances<3>(batch_v.axes(), batch_w.axes(), n, between.data());
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			EXPECT_EQ(batch_v[i], v[i]);
+			EXPECT_NEAR(between[i], geom::distance<3>(v[i], w[i]), 1e-12);
+		}
+	}
+}
+
+TEST(GeometryTest, SinglePrecisionScanKeepsPointsOnTheBoundary) {
+	std::default_random_engine engine(103);
+	std::uniform_real_distribution<double> coordinate(95, 105), offset(-4, 4);
+
+	// far from the origin, where the rounding of p to float is as large as the gaps between the squared distances
+	for (int trial = 0; trial < 500; ++trial)
+	{
+		std::array<double, 3> const p{ coordinate(engine), coordinate(engine), coordinate(engine) };
+
+		std::array<float, 3> point;
+		for (size_t axis = 0; axis < 3; ++axis)
+			point[axis] = static_cast<float>(p[axis] + offset(engine));
+
+		std::array<double, 3> const stored{ point[0], point[1], point[2] };
+		std::array<float const*, 3> const block{ &point[0], &point[1], &point[2] };
+
+		// the point is exactly at the cutoff
+		double const r = geom::distance<3>(stored, p);
+
+		size_t hits = 0;
+		geom::for_each_within_radius<3>(
+			p, block, 1, r,
+			[&stored, &p, r](size_t) { return geom::distance<3>(stored, p) <= r; },
+			[&hits](size_t) { ++hits; });
+
+		EXPECT_EQ(hits, 1);
+	}
+}
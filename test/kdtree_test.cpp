@@ -1,4 +1,7 @@
 
+#include <iterator>
+#include <set>
+
 #include "mykdpoint.h"
 
 using namespace std;
@@ -25,19 +28,10 @@ protected:
 	}
 
 
-private:
-	static int getHeightAux(MyKDTree::node* n)
-	{
-		if (n == nullptr)
-			return 0;
-		else
-			return max(getHeightAux(n->left), getHeightAux(n->right)) + 1;
-	}
-
 public:
 	static int getHeight(MyKDTree* kd)
 	{
-		return getHeightAux(kd->get_root());
+		return (int)kd->height();
 	}
 
 	template<class vector_t>
@@ -70,7 +64,8 @@ TEST_F(KDTreeTest, BalancedTree) {
 
 	KDTreeTest::shuffle(vec);
 
-	mykdtree = new MyKDTree(vec);
+	// one element per leaf
+	mykdtree = new MyKDTree(vec, 1);
 	EXPECT_EQ(KDTreeTest::getHeight(mykdtree), floor(log2(vec.size())) + 1);
 }
 
@@ -143,4 +138,463 @@ TEST_F(KDTreeTest, DistanceOnAllQuotas) {
 	EXPECT_EQ(mykdtree->range_search(MyKDPoint<3>({ 0, 0, 0 }), 1).size(), 6);
 	EXPECT_EQ(mykdtree->range_search(MyKDPoint<3>({ 0, 0, 0 }), sqrt(2)).size(), 18);
 	EXPECT_EQ(mykdtree->range_search(MyKDPoint<3>({ 0, 0, 0 }), sqrt(3)).size(), 26);
-}
\ No newline at end of file
+}
+
+TEST_F(KDTreeTest, SameResultsAsBruteForce) {
+	std::default_random_engine engine(42);
+	std::uniform_real_distribution<double> coordinate(-20, 20);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 2000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	for (size_t bucket_size : { 1, 3, 8, 32 })
+	{
+		delete mykdtree;
+		mykdtree = new MyKDTree(vec, bucket_size);
+		for (int i = 0; i < 100; ++i)
+		{
+			MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+			size_t expected = 0;
+			for (auto const& p : vec)
+				if (p.distance(test) <= 4.5)
+					++expected;
+
+			EXPECT_EQ(mykdtree->range_search(test, 4.5).size(), expected);
+		}
+	}
+}
+
+TEST_F(KDTreeTest, VisitorAndIndexBuffer) {
+	vector<MyKDPoint<3>> vec;
+	for (int x = -2; x <= 2; ++x)
+		for (int y = -2; y <= 2; ++y)
+			for (int z = -2; z <= 2; ++z)
+				vec.push_back(MyKDPoint<3>({ (double)x, (double)y, (double)z }));
+
+	KDTreeTest::shuffle(vec);
+
+	mykdtree = new MyKDTree(vec);
+	MyKDPoint<3> const origin({ 0, 0, 0 });
+
+	size_t visited = 0;
+	mykdtree->for_each_in_range(origin, sqrt(2), [&visited, &origin](MyKDPoint<3> const& p) {
+		EXPECT_LE(p.distance(origin), sqrt(2));
+		++visited;
+	});
+	EXPECT_EQ(visited, 19);
+
+	// the buffer is cleared and reused by every call
+	vector<size_t> neighbors;
+	mykdtree->range_search(origin, 1, neighbors);
+	EXPECT_EQ(neighbors.size(), 7);
+	mykdtree->range_search(origin, sqrt(3), neighbors);
+	EXPECT_EQ(neighbors.size(), 27);
+	for (auto i : neighbors)
+		EXPECT_LE((*mykdtree)[i].distance(origin), sqrt(3));
+}
+
+TEST_F(KDTreeTest, SelfJoinEnumeratesEachPairOnce) {
+	std::default_random_engine engine(11);
+	std::uniform_real_distribution<double> coordinate(-10, 10);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 500; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	size_t expected = 0;
+	for (size_t i = 0; i < vec.size(); ++i)
+		for (size_t j = i + 1; j < vec.size(); ++j)
+			if (vec[i].distance(vec[j]) <= 3)
+				++expected;
+
+	for (size_t bucket_size : { 1, 8 })
+	{
+		delete mykdtree;
+		mykdtree = new MyKDTree(vec, bucket_size);
+
+		// pairs are reported in storage order, so that (a, b) and (b, a) cannot both show up
+		size_t visited = 0;
+		mykdtree->for_each_pair_within(3, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+			EXPECT_LT(&a, &b);
+			EXPECT_LE(a.distance(b), 3);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected);
+	}
+}
+
+TEST_F(KDTreeTest, DualTreeJoinSameAsBruteForce) {
+	std::default_random_engine engine(17);
+	std::uniform_real_distribution<double> coordinate(-10, 10);
+
+	vector<MyKDPoint<3>> left, right;
+	for (int i = 0; i < 400; ++i)
+		left.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+	for (int i = 0; i < 700; ++i)
+		right.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	size_t expected = 0;
+	for (auto const& a : left)
+		for (auto const& b : right)
+			if (a.distance(b) <= 2.5)
+				++expected;
+
+	// trees of different shapes
+	for (size_t bucket_size : { 1, 8, 64 })
+	{
+		MyKDTree const left_tree(left, bucket_size), right_tree(right);
+
+		size_t visited = 0;
+		left_tree.for_each_pair_within(right_tree, 2.5, [&visited](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+			EXPECT_LE(a.distance(b), 2.5);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected);
+
+		visited = 0;
+		right_tree.for_each_pair_within(left_tree, 2.5, [&visited](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++visited; });
+		EXPECT_EQ(visited, expected);
+	}
+
+	// nothing to join with
+	size_t visited = 0;
+	MyKDTree(left).for_each_pair_within(MyKDTree(), 2.5, [&visited](MyKDPoint<3> const&, MyKDPoint<3> const&) { ++visited; });
+	EXPECT_EQ(visited, 0);
+}
+
+TEST_F(KDTreeTest, BatchSameAsSingleQueries) {
+	std::default_random_engine engine(23);
+	std::uniform_real_distribution<double> coordinate(-20, 20);
+
+	vector<MyKDPoint<3>> vec, queries;
+	for (int i = 0; i < 2000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+	for (int i = 0; i < 300; ++i)
+		queries.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	mykdtree = new MyKDTree(vec);
+	auto const batch = mykdtree->batch_range_search(queries, 4);
+	ASSERT_EQ(batch.size(), queries.size());
+
+	// results are grouped per query, in the same order of queries
+	vector<size_t> neighbors;
+	for (size_t q = 0; q < queries.size(); ++q)
+	{
+		mykdtree->range_search(queries[q], 4, neighbors);
+		vector<size_t> grouped(batch.neighbors.begin() + batch.first[q], batch.neighbors.begin() + batch.first[q + 1]);
+
+		std::sort(neighbors.begin(), neighbors.end());
+		std::sort(grouped.begin(), grouped.end());
+		EXPECT_EQ(grouped, neighbors);
+	}
+
+	EXPECT_EQ(mykdtree->batch_range_search(vector<MyKDPoint<3>>(), 4).size(), 0);
+}
+
+TEST_F(KDTreeTest, ParallelBuildSameLayout) {
+	std::default_random_engine engine(31);
+	std::uniform_real_distribution<double> coordinate(-50, 50);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 20000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	// every subtree of at least 64 elements is split across threads, as long as there are any left
+	MyKDTree const serial(vec, MyKDTree::default_bucket_size, vec.size() + 1);
+	MyKDTree const parallel(vec, MyKDTree::default_bucket_size, 64);
+
+	ASSERT_EQ(parallel.size(), serial.size());
+	for (size_t i = 0; i < serial.size(); ++i)
+		EXPECT_EQ(parallel[i].distance(serial[i]), 0);
+
+	// the threads are given back to the budget
+	EXPECT_EQ(build_threads::busy.load(), 0);
+}
+
+TEST_F(KDTreeTest, NearestNeighbors) {
+	std::default_random_engine engine(37);
+	std::uniform_real_distribution<double> coordinate(-20, 20);
+
+	vector<MyKDPoint<3>> vec;
+	for (int i = 0; i < 3000; ++i)
+		vec.push_back(MyKDPoint<3>({ coordinate(engine), coordinate(engine), coordinate(engine) }));
+
+	mykdtree = new MyKDTree(vec);
+	for (int i = 0; i < 50; ++i)
+	{
+		MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+		vector<double> distances;
+		for (auto const& p : vec)
+			distances.push_back(p.distance(test));
+		std::sort(distances.begin(), distances.end());
+
+		// from the nearest one
+		auto const nearest = mykdtree->knn(test, 10);
+		ASSERT_EQ(nearest.size(), 10);
+		for (size_t j = 0; j < nearest.size(); ++j)
+			EXPECT_DOUBLE_EQ(nearest[j].distance(test), distances[j]);
+
+		// the radius wins over k
+		size_t const within = std::upper_bound(distances.begin(), distances.end(), 2.5) - distances.begin();
+		EXPECT_EQ(mykdtree->knn(test, 1000, 2.5).size(), within);
+		EXPECT_EQ(mykdtree->knn(test, 3, 2.5).size(), std::min<size_t>(within, 3));
+	}
+
+	EXPECT_EQ(mykdtree->knn(MyKDPoint<3>({ 0, 0, 0 }), 0).size(), 0);
+	EXPECT_EQ(mykdtree->knn(MyKDPoint<3>({ 0, 0, 0 }), 5000).size(), vec.size());
+}
+
+TEST_F(KDTreeTest, IdsIntoSharedPositions) {
+	std::default_random_engine engine(41);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+
+	vector<std::array<double, 3>> positions;
+	for (int i = 0; i < 3000; ++i)
+		positions.push_back({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+	// one tree over every other position
+	vector<uint32_t> ids;
+	for (uint32_t id = 0; id < positions.size(); id += 2)
+		ids.push_back(id);
+
+	kdtree<uint32_t, 3> const tree(positions, ids);
+	ASSERT_EQ(tree.size(), ids.size());
+
+	for (int i = 0; i < 50; ++i)
+	{
+		MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+		vector<uint32_t> expected;
+		for (auto id : ids)
+			if (geom::distance<3>(positions[id], (std::array<double, 3>)test) <= 3)
+				expected.push_back(id);
+
+		auto found = tree.range_search(test, 3);
+		std::sort(found.begin(), found.end());
+		EXPECT_EQ(found, expected);
+	}
+}
+
+TEST_F(KDTreeTest, PeriodicSameAsBruteForceMinimumImage) {
+	std::default_random_engine engine(29);
+	std::uniform_real_distribution<double> fraction(0, 1);
+
+	// an orthorhombic and a triclinic box, both wider than twice the range
+	vector<geom::lattice> const boxes{
+		geom::lattice{ { { { 18, 0, 0 }, { 0, 15, 0 }, { 0, 0, 21 } } } },
+		geom::lattice{ { { { 20, 0, 0 }, { 5, 18, 0 }, { -4, 3, 16 } } } } };
+	double const range = 4;
+
+	for (auto const& box : boxes)
+	{
+		vector<MyKDPoint<3>> left, right;
+		auto const random_point = [&box, &fraction, &engine]() {
+			double const i = fraction(engine), j = fraction(engine), k = fraction(engine);
+			std::array<double, 3> p{};
+			for (size_t axis = 0; axis < 3; ++axis)
+				p[axis] = i * box.vectors[0][axis] + j * box.vectors[1][axis] + k * box.vectors[2][axis];
+			return MyKDPoint<3>(p);
+		};
+		for (int i = 0; i < 300; ++i)
+			left.push_back(random_point());
+		for (int i = 0; i < 200; ++i)
+			right.push_back(random_point());
+
+		// distance between a and the closest image of b
+		auto const min_image = [&box](MyKDPoint<3> const& a, MyKDPoint<3> const& b) {
+			double best = a.distance(b);
+			for (auto const& shift : box.neighbor_shifts())
+				best = std::min(best, geom::distance<3>((std::array<double, 3>) a, geom::sum<3>((std::array<double, 3>) b, shift)));
+			return best;
+		};
+
+		size_t expected_self = 0, expected_join = 0;
+		for (size_t i = 0; i < left.size(); ++i)
+			for (size_t j = i + 1; j < left.size(); ++j)
+				if (min_image(left[i], left[j]) <= range)
+					++expected_self;
+		for (auto const& a : left)
+			for (auto const& b : right)
+				if (min_image(a, b) <= range)
+					++expected_join;
+
+		MyKDTree const left_tree(left, 4), right_tree(right);
+
+		size_t visited = 0;
+		left_tree.for_each_pair_within(range, box, [&visited, range](MyKDPoint<3> const& a, MyKDPoint<3> const& b, std::array<double, 3> const& shift) {
+			EXPECT_LE(geom::distance<3>(geom::difference<3>((std::array<double, 3>) a, shift), (std::array<double, 3>) b), range);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected_self);
+
+		visited = 0;
+		left_tree.for_each_pair_within(right_tree, range, box, [&visited, range](MyKDPoint<3> const& a, MyKDPoint<3> const& b, std::array<double, 3> const& shift) {
+			EXPECT_LE(geom::distance<3>(geom::difference<3>((std::array<double, 3>) a, shift), (std::array<double, 3>) b), range);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected_join);
+
+		// the images of the elements around one point
+		visited = 0;
+		size_t expected = 0;
+		for (auto const& e : left)
+			if (min_image(right.front(), e) <= range)
+				++expected;
+		left_tree.for_each_in_range(right.front(), range, box, [&visited, &right, range](MyKDPoint<3> const& e, std::array<double, 3> const& shift) {
+			EXPECT_LE(geom::distance<3>((std::array<double, 3>) right.front(), geom::sum<3>((std::array<double, 3>) e, shift)), range);
+			++visited;
+		});
+		EXPECT_EQ(visited, expected);
+
+		// too large for the minimum image convention
+		EXPECT_THROW(
+			left_tree.for_each_pair_within(box.min_width(), box, [](MyKDPoint<3> const&, MyKDPoint<3> const&, std::array<double, 3> const&) {}),
+			std::invalid_argument);
+	}
+}
+
+TEST_F(KDTreeTest, RefitFollowsMovingPositions) {
+	std::default_random_engine engine(53);
+	std::uniform_real_distribution<double> coordinate(-15, 15);
+	std::uniform_real_distribution<double> step(-0.2, 0.2);
+
+	vector<std::array<double, 3>> positions;
+	for (int i = 0; i < 3000; ++i)
+		positions.push_back({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+	vector<uint32_t> ids(positions.size());
+	std::iota(ids.begin(), ids.end(), 0);
+
+	kdtree<uint32_t, 3> tree(positions, ids);
+	auto const position_of = [&positions](uint32_t id) { return positions[id]; };
+
+	auto const check = [&tree, &positions, &ids, &engine, &coordinate]() {
+		for (int i = 0; i < 30; ++i)
+		{
+			MyKDPoint<3> const test({ coordinate(engine), coordinate(engine), coordinate(engine) });
+
+			vector<uint32_t> expected;
+			for (auto id : ids)
+				if (geom::distance<3>(positions[id], (std::array<double, 3>)test) <= 3)
+					expected.push_back(id);
+
+			auto found = tree.range_search(test, 3);
+			std::sort(found.begin(), found.end());
+			EXPECT_EQ(found, expected);
+		}
+
+		size_t expected = 0, visited = 0;
+		for (size_t a = 0; a < positions.size(); ++a)
+			for (size_t b = a + 1; b < positions.size(); ++b)
+				if (geom::distance<3>(positions[a], positions[b]) <= 1.5)
+					++expected;
+		tree.for_each_pair_within(1.5, [&visited](uint32_t, uint32_t) { ++visited; });
+		EXPECT_EQ(visited, expected);
+	};
+
+	// small displacements: the layout is kept
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		for (auto& p : positions)
+			for (auto& x : p)
+				x += step(engine);
+
+		EXPECT_FALSE(tree.refit(position_of));
+		check();
+	}
+
+	// everything is scattered: the tree is rebuilt
+	shuffle(positions);
+	EXPECT_TRUE(tree.refit(position_of));
+	check();
+	EXPECT_FALSE(tree.refit(position_of));
+}
+
+TEST_F(KDTreeTest, RefitCoincidentPositions) {
+	std::default_random_engine engine(61);
+	std::uniform_real_distribution<double> jitter(-1e-5, 1e-5);
+
+	// all the boxes of the layout are points
+	vector<std::array<double, 3>> positions(500, { 12.5, -3, 7 });
+
+	vector<uint32_t> ids(positions.size());
+	std::iota(ids.begin(), ids.end(), 0);
+
+	kdtree<uint32_t, 3> tree(positions, ids);
+	auto const position_of = [&positions](uint32_t id) { return positions[id]; };
+
+	// displacements well below the minimum edge of the boxes keep the layout
+	for (int frame = 0; frame < 3; ++frame)
+	{
+		for (auto& p : positions)
+			for (auto& x : p)
+				x += jitter(engine);
+
+		EXPECT_FALSE(tree.refit(position_of));
+		EXPECT_EQ(tree.range_search(MyKDPoint<3>({ 12.5, -3, 7 }), 0.01).size(), positions.size());
+	}
+
+	// a single element has nothing to be rebuilt
+	kdtree<uint32_t, 3> single(positions, vector<uint32_t>{ 0 });
+	positions[0] = { 1, 2, 3 };
+	EXPECT_FALSE(single.refit(position_of));
+	EXPECT_EQ(single.range_search(MyKDPoint<3>({ 1, 2, 3 }), 0.01).size(), 1);
+}
+
+TEST_F(KDTreeTest, RefitCoincidentPositionsInAnyUnit) {
+	std::default_random_engine engine(67);
+
+	// the same coincident elements, with their coordinates in Å, in pm and in nm
+	for (double unit : { 1.0, 100.0, 0.1 })
+	{
+		std::uniform_real_distribution<double> jitter(-1e-5 * unit, 1e-5 * unit);
+		vector<std::array<double, 3>> positions(500, { 12.5 * unit, -3 * unit, 7 * unit });
+
+		vector<uint32_t> ids(positions.size());
+		std::iota(ids.begin(), ids.end(), 0);
+
+		kdtree<uint32_t, 3> tree(positions, ids);
+		auto const position_of = [&positions](uint32_t id) { return positions[id]; };
+
+		for (auto& p : positions)
+			for (auto& x : p)
+				x += jitter(engine);
+
+		EXPECT_FALSE(tree.refit(position_of)) << unit;
+	}
+}
+
+TEST_F(KDTreeTest, SinglePrecisionSameAsDouble) {
+	std::default_random_engine engine(59);
+	std::uniform_int_distribution<int> milli(-40000, 40000);
+
+	// coordinates with 3 decimals, as in PDB files
+	vector<std::array<double, 3>> positions;
+	for (int i = 0; i < 4000; ++i)
+		positions.push_back({ milli(engine) / 1000., milli(engine) / 1000., milli(engine) / 1000. });
+
+	vector<uint32_t> ids(positions.size());
+	std::iota(ids.begin(), ids.end(), 0);
+
+	for (double range : { 3.5, 6.5 })
+	{
+		std::set<std::pair<uint32_t, uint32_t>> exact, single;
+		kdtree<uint32_t, 3>(positions, ids).for_each_pair_within(range, [&exact](uint32_t a, uint32_t b) {
+			exact.insert(std::minmax(a, b));
+		});
+		kdtree<uint32_t, 3, float>(positions, ids).for_each_pair_within(range, [&single](uint32_t a, uint32_t b) {
+			single.insert(std::minmax(a, b));
+		});
+
+		// only pairs on the boundary may be told apart differently
+		vector<std::pair<uint32_t, uint32_t>> different;
+		std::set_symmetric_difference(exact.begin(), exact.end(), single.begin(), single.end(), std::back_inserter(different));
+		for (auto const& [a, b] : different)
+			EXPECT_NEAR(geom::distance<3>(positions[a], positions[b]), range, 1e-4);
+
+		EXPECT_LE(different.size(), exact.size() / 1000);
+	}
+}